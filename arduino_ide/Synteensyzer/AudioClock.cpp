@@ -0,0 +1 @@
+../../src/AudioClock.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/AudioClock.h
\ No newline at end of file
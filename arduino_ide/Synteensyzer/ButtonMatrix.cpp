@@ -0,0 +1 @@
+../../src/ButtonMatrix.cpp
\ No newline at end of file
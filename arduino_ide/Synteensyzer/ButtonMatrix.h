@@ -0,0 +1 @@
+../../include/ButtonMatrix.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ButtonScanner.cpp
\ No newline at end of file
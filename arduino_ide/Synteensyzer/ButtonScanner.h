@@ -0,0 +1 @@
+../../include/ButtonScanner.h
\ No newline at end of file
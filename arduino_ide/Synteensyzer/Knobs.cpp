@@ -0,0 +1 @@
+../../src/Knobs.cpp
\ No newline at end of file
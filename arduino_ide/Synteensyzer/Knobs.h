@@ -0,0 +1 @@
+../../include/Knobs.h
\ No newline at end of file
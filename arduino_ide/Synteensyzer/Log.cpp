@@ -0,0 +1 @@
+../../src/Log.cpp
\ No newline at end of file
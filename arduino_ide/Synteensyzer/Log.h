@@ -0,0 +1 @@
+../../include/Log.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/LoopArena.cpp
\ No newline at end of file
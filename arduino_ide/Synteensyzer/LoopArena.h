@@ -0,0 +1 @@
+../../include/LoopArena.h
\ No newline at end of file
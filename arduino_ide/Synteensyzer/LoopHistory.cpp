@@ -0,0 +1 @@
+../../src/LoopHistory.cpp
\ No newline at end of file
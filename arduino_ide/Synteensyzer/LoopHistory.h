@@ -0,0 +1 @@
+../../include/LoopHistory.h
\ No newline at end of file
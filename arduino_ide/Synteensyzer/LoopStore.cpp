@@ -0,0 +1 @@
+../../src/LoopStore.cpp
\ No newline at end of file
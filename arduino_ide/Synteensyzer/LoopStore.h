@@ -0,0 +1 @@
+../../include/LoopStore.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/LoopTrack.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/LoopTrack.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/LoopTransform.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/LoopTransform.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/Metrics.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/Metrics.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/MidiClock.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/MidiClock.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/NoteSet.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/Panel.cpp
\ No newline at end of file
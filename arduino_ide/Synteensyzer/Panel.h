@@ -0,0 +1 @@
+../../include/Panel.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ParamMap.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/ParamMap.h
\ No newline at end of file
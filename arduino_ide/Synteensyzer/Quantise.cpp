@@ -0,0 +1 @@
+../../src/Quantise.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/Quantise.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/Scheduler.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/Scheduler.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/SmfCodec.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../include/SmfCodec.h
\ No newline at end of file
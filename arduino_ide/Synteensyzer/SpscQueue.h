@@ -0,0 +1 @@
+../../include/SpscQueue.h
\ No newline at end of file
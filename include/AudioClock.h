@@ -0,0 +1,39 @@
+#pragma once
+// ============================================================
+// AudioClock.h -- Sample-counting timebase driven by the audio ISR
+//
+// MyDsp::update() advances a sample counter by one block each
+// time the audio library asks for audio, so the counter runs at
+// exactly the codec's sample rate and never drifts against the
+// sound.  Between two updates, now() interpolates with micros()
+// to give a sample-accurate position to the main loop.
+//
+// A uint32_t sample counter wraps after ~27 h at 44.1 kHz; all
+// comparisons use unsigned differences, so wrap-around is safe.
+// ============================================================
+
+#include <Arduino.h>
+#include <Audio.h>
+
+namespace AudioClock {
+
+/// Count one rendered block.  Called at the end of MyDsp::update() (ISR).
+void advance(uint32_t samples);
+
+/// Samples rendered so far.  Inside update() (before advance())
+/// this is the index of the first sample of the block being made.
+uint32_t blockStart();
+
+/// Current position in samples, interpolated inside the current
+/// block.  Safe to call from the main loop.
+uint32_t now();
+
+/// Conversions, for logging and ms-based settings.
+inline uint32_t toMs(uint32_t samples) {
+  return (uint32_t)((float)samples * (1000.0f / AUDIO_SAMPLE_RATE_EXACT));
+}
+inline uint32_t fromMs(uint32_t ms) {
+  return (uint32_t)((float)ms * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f));
+}
+
+}  // namespace AudioClock
@@ -2,20 +2,22 @@
 // ============================================================
 // Button.h -- Debounced push-button with short / long press
 //
-// Handles hardware debouncing for a normally-open button wired
-// with INPUT_PULLUP (active LOW).  On release, the held
-// duration is measured to distinguish a short press from a
-// long press.  Two user-supplied callbacks are invoked
-// accordingly.
+// A normally-open button wired with INPUT_PULLUP (active LOW).
+// Debouncing happens in ButtonScanner's timer interrupt; the
+// button only sees the accepted press and release, each stamped
+// with its scan time.  On release, the held duration picks the
+// short or long press callback.
 //
 // Usage:
 //   DebouncedButton btn(pin, onShort, onLong);
-//   btn.begin();          // in setup()
-//   btn.update();         // in loop(), every iteration
+//   btn.begin();              // in setup(): pin + scanner entry
+//   ButtonScanner::begin();   // in setup(), after every button
+//   ButtonScanner::poll();    // in loop(): fires the callbacks
 // ============================================================
 
 #include <Arduino.h>
 #include "config.h"
+#include "ButtonScanner.h"
 
 class DebouncedButton {
 public:
@@ -27,20 +29,19 @@ public:
   /// @param onLong  called on release after a long  press (>= kLongPressMs)
   DebouncedButton(int pin, Callback onShort, Callback onLong);
 
-  /// Configure the pin.  Call once in setup().
+  /// Configure the pin and register it with ButtonScanner.
+  /// Call once in setup(), before ButtonScanner::begin().
   void begin();
 
-  /// Read the pin and fire callbacks if needed.
-  /// Call every iteration of loop().
-  void update();
+  /// A debounced change at scan time `ms`.  Called by
+  /// ButtonScanner::poll() on the main thread.
+  void onEvent(bool pressed, uint32_t ms);
 
 private:
   int      pin_;
   Callback onShort_;
   Callback onLong_;
 
-  bool     stableState_   = true;   // HIGH = released (INPUT_PULLUP)
-  bool     lastRawRead_   = true;
-  uint32_t lastChangeMs_  = 0;
+  bool     pressed_       = false;
   uint32_t pressStartMs_  = 0;
 };
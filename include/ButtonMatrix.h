@@ -0,0 +1,38 @@
+#pragma once
+// ============================================================
+// ButtonMatrix.h -- Scanned key matrix for the control panel
+//
+// kMatrixRows x kMatrixCols keys behind one IntervalTimer.  Each
+// tick reads the columns of one row and drives the next, so a
+// tick costs the same whatever the number of rows (or keys held):
+// one column read per column, a few bit operations, and one
+// event per key that actually changed.
+//
+// The row's columns are debounced together with 2-bit vertical
+// counters: a key's level has to disagree with its accepted state
+// on four visits to its row in a row before it flips.  Accepted
+// changes go into an SpscQueue like ButtonScanner's; Panel drains
+// them and recognises gestures.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+#include "ButtonScanner.h"
+
+namespace ButtonMatrix {
+
+/// A key change; `button` is the key index
+/// (row * kMatrixCols + column).
+using Event = ButtonScanner::Event;
+
+/// Configure the row and column pins and start scanning.
+/// Call once in setup().
+void begin();
+
+/// Take the oldest key change; false if there is none.
+bool pop(Event& ev);
+
+/// Key changes lost because the queue was full.
+uint32_t dropped();
+
+}  // namespace ButtonMatrix
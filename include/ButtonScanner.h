@@ -0,0 +1,50 @@
+#pragma once
+// ============================================================
+// ButtonScanner.h -- Timer-driven button scanning and events
+//
+// An IntervalTimer samples every registered pin each
+// kButtonScanUs and runs a counting debounce per pin: a level
+// has to hold for kDebounceMs scans before it is accepted.
+// Each accepted change is stamped with the scan time and posted
+// to a single-producer / single-consumer queue; poll() drains it
+// on the main thread and hands each event to its button.
+//
+// So press timing is measured in the ISR, and a slow loop()
+// (an SD write, a long transform) only delays the callback, not
+// the debounce or the short/long decision.
+//
+// Register every button before begin(): the list is read from
+// the timer interrupt and never locked.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+class DebouncedButton;
+
+namespace ButtonScanner {
+
+/// One debounced change of one button.
+struct Event {
+  uint8_t  button;    // index returned by add()
+  bool     pressed;
+  uint32_t ms;        // scan time of the accepted change
+};
+
+/// Watch `pin` (already configured) for `button`.  Index of the
+/// new entry, or -1 if kMaxButtons are already registered.
+int add(int pin, DebouncedButton* button);
+
+/// Start the scan timer.  Call once in setup(), after add().
+void begin();
+
+/// Take the oldest event; false if the queue is empty.
+bool pop(Event& ev);
+
+/// Deliver every queued event to its button.  Call from loop().
+void poll();
+
+/// Events lost because the queue was full.
+uint32_t dropped();
+
+}  // namespace ButtonScanner
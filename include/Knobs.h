@@ -0,0 +1,38 @@
+#pragma once
+// ============================================================
+// Knobs.h -- Potentiometers on the ADC, fed to the ParamMap path
+//
+// A timer interrupt converts one knob per tick and sums
+// kAnalogOversample conversions into one 14-bit sample.  poll()
+// then, on the main thread:
+//
+//   1. smooths each knob with a one-pole integer IIR filter,
+//   2. only passes a value on once it has moved more than
+//      kAnalogHysteresis from the last one sent (the ends of the
+//      travel always get through, so 0 and full scale are exact),
+//   3. sends it through MidiHandler::applyParam() as a 14-bit
+//      value, exactly like a 14-bit CC for that parameter.
+//
+// So a knob at rest sends nothing, and a MIDI CC for the same
+// parameter keeps its value until the knob is actually moved.
+// Each knob's position is sent once at startup.  Nothing runs
+// unless kKnobsFitted is set.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+namespace Knobs {
+
+/// Set up the ADC and start sampling.  Call once in setup(),
+/// after MidiHandler::begin().
+void begin();
+
+/// Filter new samples and send the knobs that moved.
+/// Call from loop().
+void poll();
+
+/// Filtered position of knob `k`, 0..16383.
+uint16_t value(int k);
+
+}  // namespace Knobs
@@ -0,0 +1,44 @@
+#pragma once
+// ============================================================
+// Log.h -- Buffered serial log, drained in slices
+//
+// A Print that writes into a RAM ring instead of the USB serial
+// port, so a burst of log lines (a fast run of MIDI notes, say)
+// costs a memcpy where it happens.  drain() moves at most a slice
+// of it to Serial, and never more than Serial can take without
+// blocking; the scheduler runs it as a low-priority task.
+//
+// When the ring is full, new text is dropped and counted rather
+// than stalling the caller.  Main thread only.
+//
+// Usage:
+//   Log.print("[MIDI] NoteON: note=");   // anywhere on the main thread
+//   Log.drain(kLogSliceBytes);           // one slice, from the log task
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+class LogBuffer : public Print {
+public:
+  using Print::write;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t size) override;
+
+  /// Send up to `maxBytes` to Serial.  True if text is still waiting.
+  bool drain(int maxBytes);
+
+  /// Bytes waiting to be sent.
+  int pending() const { return (int)(head_ - tail_); }
+
+  /// Bytes lost because the ring was full.
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  uint8_t  ring_[kLogBufferBytes];
+  uint32_t head_    = 0;
+  uint32_t tail_    = 0;
+  uint32_t dropped_ = 0;
+};
+
+extern LogBuffer Log;
@@ -0,0 +1,36 @@
+#pragma once
+// ============================================================
+// LoopArena.h -- Shared chunk memory for the looper's streams
+//
+// One static arena of kLoopArenaChunks chunks, kLoopChunkBytes
+// each.  A LoopTrack takes chunks as its stream grows and gives
+// them all back when it is cleared, so memory follows what was
+// actually played: a one-bar loop holds one chunk, not a whole
+// kLoopStreamBytes stream, and the rest stays free for other
+// layers and scenes.
+//
+// alloc() and release() run on the main thread only; the audio
+// ISR just reads chunks that are in use.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+namespace LoopArena {
+
+constexpr uint8_t kNone = 0xFF;
+static_assert(kLoopArenaChunks < kNone, "chunk ids are bytes");
+
+/// Take a free chunk, or kNone if the arena is full.
+uint8_t alloc();
+
+/// Give a chunk back.
+void release(uint8_t id);
+
+/// Start of chunk `id`.
+uint8_t* chunk(uint8_t id);
+
+/// Chunks not in use.
+int freeChunks();
+
+}  // namespace LoopArena
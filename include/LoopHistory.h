@@ -0,0 +1,95 @@
+#pragma once
+// ============================================================
+// LoopHistory.h -- Refcounted pool of loop layers with undo/redo
+//
+// A fixed pool of kLoopPoolTracks LoopTracks.  Once committed, a
+// layer is immutable and becomes a node in a history chain: each
+// node references the layer below it, and a chain's `head` is its
+// top layer.  The layers that play are the chain from the root up
+// to head.  Every loop scene has its own chain (and redo stack);
+// they all share the pool.
+//
+//   undo:  head moves down to its parent; the old head goes on
+//          the redo stack
+//   redo:  head moves back up
+//
+// Neither copies any event data -- only head and reference
+// counts change.  A node is returned to the pool, and its chunks
+// to the LoopArena, when nothing (a head, a child, a redo stack
+// or the recorder) references it.  Committing a new layer drops
+// that scene's redo stack, as in any editor.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+#include "LoopTrack.h"
+
+class LoopHistory {
+public:
+  static constexpr uint8_t kNone = 0xFF;
+
+  LoopHistory();
+
+  /// Release every layer of `scene` (the slot being recorded, if
+  /// any, stays allocated: pass it to discard()).
+  void clear(int scene);
+
+  /// Take a free slot to record into, or kNone if the pool is
+  /// full.  The redo histories are given up first if that frees one.
+  uint8_t alloc();
+
+  /// Return an uncommitted slot from alloc() to the pool.
+  void discard(uint8_t slot);
+
+  /// Commit a recorded slot as the new top layer of `scene` (and
+  /// build its note-pairing index for reverse playback).
+  void push(int scene, uint8_t slot);
+
+  /// Put a rewritten copy (a slot from alloc()) in place of the
+  /// scene's top layer; the old one is released.
+  void replaceHead(int scene, uint8_t slot);
+
+  /// Give the scene a whole new set of layers (slots from alloc(),
+  /// root first) in place of its history, which is released.
+  void replaceAll(int scene, const uint8_t* slots, int count);
+
+  /// The scene's top layer, or kNone.
+  uint8_t head(int scene) const { return chains_[scene].head; }
+
+  /// Move the scene's head down / up one layer.  undo() keeps at
+  /// least the root layer.  Return false if there is nothing to do.
+  bool undo(int scene);
+  bool redo(int scene);
+
+  LoopTrack&       track(uint8_t slot)       { return nodes_[slot].track; }
+  const LoopTrack& track(uint8_t slot) const { return nodes_[slot].track; }
+
+  /// Fill `out` with the scene's playing slots, root first.
+  /// Returns the number of layers (at most kLoopPoolTracks).
+  int layers(int scene, uint8_t* out) const;
+
+  int redoDepth(int scene) const { return chains_[scene].redoCount; }
+
+  /// Extra references, e.g. to keep layers alive while they are
+  /// being saved.
+  void retain(uint8_t slot);
+  void release(uint8_t slot);
+
+private:
+  struct Node {
+    LoopTrack track;
+    uint8_t   parent = kNone;
+    uint8_t   refs   = 0;      // 0 = free
+  };
+
+  struct Chain {
+    uint8_t head = kNone;
+    uint8_t redo[kLoopPoolTracks];
+    int     redoCount = 0;
+  };
+
+  void dropRedo(Chain& c);
+
+  Node  nodes_[kLoopPoolTracks];
+  Chain chains_[kLoopScenes];
+};
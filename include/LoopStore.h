@@ -0,0 +1,47 @@
+#pragma once
+// ============================================================
+// LoopStore.h -- Save / load the loop as a Standard MIDI File
+//
+// The loop (all layers merged, loop length, frozen preset) is
+// written to kLoopFilePath on the SD card as an SMF type 0 file
+// that any DAW can open, and can be loaded back -- also from a
+// file made on the PC.
+//
+// Saving is streamed: save() only opens the file, and poll()
+// writes kSmfChunkBytes per call from loop(), so the main loop
+// never waits on more than one SD sector write.  Loading runs in one go (the
+// loop is replaced anyway).
+//
+// In the file (all on channel 1):
+//   notes            → Note On / Note Off
+//   recorded params  → Control Change on the param's default CC
+//                      (CC 0..31: plus the LSB on the CC 32 above)
+//   preset changes   → Program Change
+//   bend / pressure  → Pitch Bend / Channel Pressure
+//   frozen preset    → Program Change at tick 0, first
+//   loop length      → End of Track
+// One file tick is one LoopTrack tick, so a saved loop reloads
+// with exactly the same timing.
+// ============================================================
+
+class Looper;
+
+namespace LoopStore {
+
+/// Mount the SD card.  Call once in setup().
+void begin(Looper& looper);
+
+/// Start saving the current loop.  False if there is no loop, no
+/// card, or a save is already running.
+bool save();
+
+/// Replace the loop with the file's contents and start playing.
+bool load();
+
+/// Write the next chunk of a running save.  Call every loop().
+void poll();
+
+/// True while a save is in progress.
+bool busy();
+
+}  // namespace LoopStore
@@ -0,0 +1,208 @@
+#pragma once
+// ============================================================
+// LoopTrack.h -- Compact delta-encoded event stream for the looper
+//
+// Events are stored as a byte stream, much like a Standard MIDI
+// File track:
+//
+//   <delta> [status] <data1> [data2 [data3]]
+//
+//   delta   variable-length quantity (7 bits per byte, MSB set
+//           on all but the last byte), in ticks of
+//           2^kLoopTickShift samples since the previous event
+//   status  0x80 | type, written only when the type changes
+//           (running status); data bytes are always < 0x80
+//   data    NOTE_ON: note, velocity (velocity 0 = NOTE_OFF, so
+//           note-offs share the note-on running status)
+//           PARAM:   ParamId, MSB, LSB (14-bit value)
+//           BEND:    LSB, MSB (14-bit, centre 8192)
+//           PROGRAM / PRESSURE: one byte
+//
+// Runs of the same controller (a bend wheel sweep, a fader move)
+// ride on running status at 2-4 bytes per step.
+//
+// A typical event is 3-4 bytes instead of the 8 of a padded
+// LoopEvent.  Every kLoopSyncBytes a sync point is recorded in a
+// small index (byte offset + time), and running status restarts
+// there, so a seek is a binary search plus a short forward
+// decode.
+//
+// The stream is not one fixed array: it grows in kLoopChunkBytes
+// chunks taken from the shared LoopArena, and clear() gives them
+// back, so a track only holds the memory its events need.
+//
+// Once a track is complete, buildPairs() writes a note-pairing
+// index right after the stream: one byte per event, giving each
+// note-off the velocity of the note-on it ends.  Reverse playback
+// turns note-offs into note-ons with it.  The same pass notes the
+// track's loop-point crossings: the notes it leaves sounding at
+// its end, and the note-offs that end notes from before its start.
+//
+// LoopMerge reads several tracks (the looper's layers) as one
+// time-ordered stream.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+#include "LoopArena.h"
+#include "NoteSet.h"
+
+// --- Event types -----------------------------------------------
+
+enum LoopEventType : uint8_t {
+  EVT_NOTE_ON  = 1,
+  EVT_NOTE_OFF = 2,
+  EVT_PARAM    = 3,     // ParamMap parameter (e.g. sustain pedal)
+  EVT_PROGRAM  = 4,     // preset change
+  EVT_BEND     = 5,     // pitch bend
+  EVT_PRESSURE = 6      // channel pressure
+};
+
+/// Continuous controllers: replay may coalesce them.
+inline bool isControlEvent(uint8_t type) {
+  return type == EVT_PARAM || type == EVT_BEND || type == EVT_PRESSURE;
+}
+
+/// A single decoded MIDI event with its timestamp.
+struct LoopEvent {
+  uint32_t time;        // offset in samples from recording start
+  uint8_t  type;        // LoopEventType
+  uint8_t  note;        // note (PARAM: ParamId, PROGRAM: preset,
+                        //       BEND: LSB, PRESSURE: value)
+  uint8_t  velocity;    // velocity (PARAM: MSB, BEND: MSB)
+  uint8_t  fine;        // PARAM: LSB (fills the padding byte)
+};
+
+/// Read position in a LoopTrack.  `next` holds the event under
+/// the cursor while `valid` is true.
+struct LoopCursor {
+  LoopEvent next    = {};
+  bool      valid   = false;
+  int       index   = 0;    // event number of `next`
+  uint16_t  pos     = 0;    // byte offset after `next`
+  uint8_t   status  = 0;    // running status
+  uint32_t  ticks   = 0;    // quantised time of `next`
+};
+
+// --- LoopTrack class -------------------------------------------
+
+class LoopTrack {
+public:
+  LoopTrack();
+  ~LoopTrack() { clear(); }
+
+  // Owns its chunks: never copied
+  LoopTrack(const LoopTrack&)            = delete;
+  LoopTrack& operator=(const LoopTrack&) = delete;
+
+  /// Drop all events and return the chunks to the arena.
+  void clear();
+
+  /// Append an event.  Times must not decrease; they are rounded
+  /// down to the tick grid.  Returns false if the stream is full
+  /// or the arena has no chunk left.
+  bool append(const LoopEvent& ev);
+
+  int      count() const { return count_; }
+  uint16_t bytes() const { return bytes_; }
+
+  /// Time of the last event (on the tick grid).
+  uint32_t lastTime() const { return lastTicks_ << kLoopTickShift; }
+
+  // --- Reading -------------------------------------------------
+
+  /// Put the cursor on the first event.
+  void rewind(LoopCursor& c) const;
+
+  /// Put the cursor on the first event at or after `time`.
+  void seek(LoopCursor& c, uint32_t time) const;
+
+  /// Move the cursor to the following event.
+  void advance(LoopCursor& c) const;
+
+  // --- Reverse playback ----------------------------------------
+
+  /// Build the note-pairing index (call once the track is
+  /// complete; append() drops it).  False if there is no room
+  /// for it after the stream.
+  bool buildPairs();
+
+  /// Velocity of the note-on that note-off `index` ends: 0 if it
+  /// ends none, kReverseVelocity if there is no index.
+  uint8_t pairedVelocity(int index) const;
+
+  // --- Loop point (set by buildPairs(), even without room) ----
+
+  /// Notes still sounding after the last event.
+  const NoteSet& crossOut() const { return crossOut_; }
+
+  /// Notes with a note-off before any note-on in the track.
+  const NoteSet& crossIn() const { return crossIn_; }
+
+private:
+  struct SyncPoint {
+    uint32_t ticks;     // time the first delta after `offset` is relative to
+    uint16_t offset;    // byte offset of an event with an explicit status
+    uint16_t index;     // event number at `offset`
+  };
+
+  static constexpr int kMaxSyncPoints = kLoopStreamBytes / kLoopSyncBytes + 1;
+  static constexpr int kMaxChunks     = kLoopStreamBytes / kLoopChunkBytes;
+
+  void startAt(LoopCursor& c, const SyncPoint& s) const;
+
+  /// Take chunks until the first `end` bytes are backed.
+  bool reserve(uint32_t end);
+
+  /// Byte `pos` of the stream (its chunk must be held).
+  uint8_t* at(uint32_t pos) const {
+    return LoopArena::chunk(chunks_[pos >> kLoopChunkShift]) + (pos & (kLoopChunkBytes - 1));
+  }
+
+  uint8_t   chunks_[kMaxChunks];
+  uint8_t   chunkCount_ = 0;
+  uint16_t  bytes_     = 0;
+  int       count_     = 0;
+  uint32_t  lastTicks_ = 0;
+  uint8_t   status_    = 0;     // running status of the writer
+  bool      paired_    = false; // pairing index at byte bytes_
+  NoteSet   crossOut_;
+  NoteSet   crossIn_;
+
+  SyncPoint syncs_[kMaxSyncPoints];
+  int       syncCount_ = 0;
+};
+
+// --- LoopMerge class -------------------------------------------
+
+/// k-way merge of up to kLoopPoolTracks tracks by event time.  A
+/// min-heap of cursors gives the earliest pending event at once
+/// and consumes it in O(log tracks); on equal times the track
+/// added first wins.
+class LoopMerge {
+public:
+  /// Remove all tracks.
+  void clear();
+
+  /// Join `track`, starting at its first event at or after `from`.
+  void add(const LoopTrack& track, uint32_t from = 0);
+
+  /// Earliest pending event across all tracks, or nullptr.
+  const LoopEvent* peek() const;
+
+  /// Consume the event returned by peek().
+  void advance();
+
+  /// Track (in order of add()) and event number of peek().
+  int topTrack() const { return heap_[0]; }
+  int topIndex() const { return cursors_[heap_[0]].index; }
+
+private:
+  bool less(uint8_t a, uint8_t b) const;
+
+  const LoopTrack* tracks_[kLoopPoolTracks];
+  LoopCursor       cursors_[kLoopPoolTracks];
+  uint8_t          heap_[kLoopPoolTracks];    // track indices, earliest event on top
+  int              count_    = 0;
+  int              heapSize_ = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+// ============================================================
+// LoopTransform.h -- One-pass rewrites of a loop layer
+//
+// apply() streams a layer into a fresh one and changes it on the
+// way: note-ons pulled toward a grid (with a strength), moved at
+// random (humanise), transposed, and their velocities scaled or
+// compressed.  A note-off always follows its note-on, so notes
+// keep their length and pitch pairing.  The output stays in time
+// order through a small re-ordering window (see apply()).
+//
+// Committed layers are immutable: the looper rewrites each layer
+// into a new pool slot and swaps the new set in on a loop
+// boundary (Looper::quantiseLoop() and friends).  Quantise::apply
+// is the full-strength grid case.
+// ============================================================
+
+#include <Arduino.h>
+#include "LoopTrack.h"
+
+namespace LoopTransform {
+
+/// What to do to each note.  The defaults change nothing.
+struct Params {
+  uint32_t length    = 0;      // loop length: events played at or after it are dropped
+  uint32_t beat      = 0;      // grid step = beat / div (div 0: no grid)
+  int      div       = 0;
+  float    strength  = 1.0f;   // 0..1 of the way to the grid point
+  uint32_t jitter    = 0;      // humanise: max time offset, samples
+  uint8_t  velJitter = 0;      // humanise: max velocity offset
+  int      transpose = 0;      // semitones; notes pushed out of 0..127 are dropped
+  float    velScale  = 1.0f;
+  float    compress  = 0.0f;   // 0..1 of the way to kVelocityCentre
+};
+
+/// Copy `in` to `out` with `p` applied to every note.  A note-on
+/// moved past the loop end wraps round to its start, and its
+/// note-off with it.  False if `out` ran out of room, or too many
+/// notes wrapped to re-order.
+bool apply(const LoopTrack& in, LoopTrack& out, const Params& p);
+
+}  // namespace LoopTransform
@@ -2,120 +2,428 @@
 // ============================================================
 // Looper.h -- MIDI event looper with record / play / stop
 //
-// Records NoteOn/NoteOff events with timestamps into a fixed
-// buffer, then plays them back in a continuous loop.
+// Records every channel message -- notes, parameter CCs, program
+// changes, pitch bend and channel pressure -- with timestamps
+// into a compact delta-encoded stream (LoopTrack), then plays
+// them back in a continuous loop.  On replay, controller moves
+// that land in the same audio block are coalesced: each
+// controller is set once per block, with its latest value.
 //
-// The synthesiser preset active at recording start is "frozen"
-// so the loop always sounds the same regardless of later preset
-// changes on the live synth.
+// Playback runs on the PART_LOOP part of the shared synth
+// engine.  The preset active at recording start is "frozen" into
+// that part so the loop always sounds the same regardless of
+// later preset changes on the live parts.
+//
+// Overdub: from STOPPED, a short press restarts the loop and
+// records on top of it.  Every pass of the loop becomes a new
+// layer, locked to the first take's length.  Layers come from a
+// refcounted pool (LoopHistory), so undo()/redo() of the last
+// layer only move the history head.  Playback merges the
+// layers' time-sorted streams through a small min-heap
+// (LoopMerge), so each step costs O(log layers) per due event,
+// whatever the number of layers.
 //
 // State machine (transitions via onShortPress / onLongPress):
 //
 //         short press        short press       short press
 // EMPTY ──────────────► RECORDING ──────────► PLAYING ──────────► STOPPED
-//   ▲                                            │                   │
-//   │              long press (3s)                │   short press     │
-//   └────────────────────────────────────────────┴───────────────────┘
-//                         CLEAR
+//                                               ▲                   │
+//                                   short press │                   │ short press
+//                                               └──── OVERDUB ◄─────┘
+//
+// Long press (3s) in any state: CLEAR -> EMPTY
+// CC_LOOP_UNDO / CC_LOOP_REDO: remove / restore the top layer
+// CC_LOOP_QUANTISE: snap takes to the beat (see Quantise.h)
+// CC_LOOP_SPEED / CC_LOOP_REVERSE: playback rate and direction
+// Program Change on kLoopSceneChannel / scene button: loop scene
+// CC_LOOP_GRID .. CC_LOOP_COMPRESS: rewrite the loop (LoopTransform)
+//
+// Scenes: kLoopScenes independent loops, each with its own layer
+// history, length, beat and frozen preset.  All of them share the
+// layer pool and the chunk arena (LoopArena), so a scene costs
+// only the events it holds.  While a loop plays, a new scene is
+// staged and the audio ISR swaps it in exactly on the loop
+// boundary -- only the playing slot list changes, no events are
+// copied.  Stopped or empty, the switch is immediate.
+//
+// Loop point: notes held across it are not cut.  A note whose
+// note-on is left open at a layer's end and whose note-off comes
+// early in a layer (the next overdub pass, or the take's own
+// tail) keeps sounding through the wrap, and stops at its
+// note-off.  Keys still held when a take is committed have their
+// note-offs caught during the next cycle and merged into the take
+// at their position.  Everything else still stops on the wrap.
+//
+// Transforms rewrite every layer of the scene into fresh pool
+// slots while the old ones keep playing, then stage the new set
+// like a scene switch: the ISR swaps it in on the loop boundary,
+// so playback never waits for the rewrite.
+//
+// Speed: at any rate other than 1x forward, the loop position is
+// a Q16.16 accumulator stepped by the rate on every output
+// sample, and events play where it reaches them.  Reverse reads
+// each block's window of events backwards through seek(), turning
+// note-ons into note-offs and note-offs into note-ons with the
+// velocity from the track's pairing index.  Nothing is copied or
+// re-encoded when the speed changes.  Overdub records at 1x
+// forward only.
+//
+// Slaved to a running MIDI clock (MidiClock), recording starts on
+// the nearest beat, the loop is a whole number of beats, and each
+// cycle is stretched to end on the clock's predicted downbeat, so
+// the loop follows the clock's tempo without drifting.  The
+// stretch only scales playback: event times, overdubs and saved
+// files keep the loop's own length.  As clock
+// master, the loop's start and beat drive the clock sent out.
 // ============================================================
 
 #include <Arduino.h>
 #include "config.h"
+#include "LoopTrack.h"
+#include "LoopHistory.h"
+#include "NoteSet.h"
+#include "ParamMap.h"
+#include "Quantise.h"
+#include "LoopTransform.h"
+#include "MidiClock.h"
 
 class MyDsp;   // forward declaration (avoids circular include)
 
-// --- Event types stored in the loop buffer ---------------------
-
-enum LoopEventType : uint8_t {
-  EVT_NOTE_ON  = 1,
-  EVT_NOTE_OFF = 2
-};
-
-/// A single recorded MIDI event with its timestamp.
-struct LoopEvent {
-  uint32_t timeMs;      // offset in ms from recording start
-  uint8_t  type;        // EVT_NOTE_ON or EVT_NOTE_OFF
-  uint8_t  note;        // MIDI note number
-  uint8_t  velocity;    // velocity (only meaningful for NOTE_ON)
-};
-
 // --- Looper states ---------------------------------------------
 
 enum LoopState : uint8_t {
   LOOP_EMPTY = 0,
   LOOP_RECORDING,
   LOOP_PLAYING,
-  LOOP_STOPPED
+  LOOP_STOPPED,
+  LOOP_OVERDUB          // playing + recording a new layer
 };
 
 // --- Looper class ----------------------------------------------
 
 class Looper {
 public:
-  /// Constructor: takes references to both synth instances.
-  /// @param liveSynth   the synth used for live playing
-  /// @param looperSynth the synth dedicated to loop playback
-  Looper(MyDsp& liveSynth, MyDsp& looperSynth);
+  /// @param synth the shared engine; the loop plays on PART_LOOP
+  explicit Looper(MyDsp& synth);
 
   /// Advance playback by one tick.  Must be called every
   /// iteration of loop() so events are replayed on time.
+  /// Positions come from AudioClock, so the loop stays locked to
+  /// the audio sample rate however irregularly this is called.
+  /// Does nothing when kLooperAudioThread is set.
   void tick();
 
+  /// Audio-thread playback: install as the synth's block callback
+  /// (kLooperAudioThread).  Injects the events that fall in the
+  /// block at their exact sample offsets.  Runs in the audio ISR.
+  void renderBlock(uint32_t blockStart);
+
   // --- State transitions (called by Button callbacks) ----------
 
-  /// Cycle through: EMPTY→REC, REC→PLAY, PLAY→STOP, STOP→REC
+  /// Cycle through: EMPTY→REC, REC→PLAY, PLAY→STOP,
+  /// STOP→OVERDUB, OVERDUB→PLAY
   void onShortPress();
 
   /// Always clear the loop and return to EMPTY.
   void onLongPress();
 
+  // --- Layer history (called by MidiHandler) -------------------
+
+  /// Remove the top overdub layer (the base take stays).  During
+  /// an overdub, drops the pass being recorded instead.
+  void undo();
+
+  /// Bring back the last undone layer.
+  void redo();
+
   // --- MIDI event recording (called by MidiHandler) ------------
 
-  /// Forward a NoteOn to the looper synth (if recording) and
-  /// store it in the event buffer.
+  /// Store a NoteOn in the event buffer (if recording).  The live
+  /// part already sounds it, so nothing is sent to PART_LOOP.
   void recordNoteOn(uint8_t note, uint8_t vel);
 
-  /// Forward a NoteOff to the looper synth (if recording) and
-  /// store it in the event buffer.
+  /// Store a NoteOff in the event buffer (if recording).
   void recordNoteOff(uint8_t note);
 
+  /// Store a parameter move (ParamMap id, normalised value) in
+  /// the event buffer at 14 bits, if recording.
+  void recordParam(uint8_t id, float x01);
+
+  /// Store a preset change, if recording.
+  void recordProgram(int preset);
+
+  /// Store a pitch bend (raw 14-bit value, centre 8192), if recording.
+  void recordPitchBend(uint16_t value);
+
+  /// Store a channel pressure value (0..127), if recording.
+  void recordPressure(uint8_t value);
+
+  // --- Playback speed (called by MidiHandler) ------------------
+
+  /// Set the playback rate (Q16.16, 1 << kLoopRateShift = 1x,
+  /// clamped to 1/4x..4x) and direction.  Playback carries on from
+  /// the current position.  A running overdub is committed first.
+  void setSpeed(uint32_t rate, bool reverse);
+  void setRate(uint32_t rate) { setSpeed(rate, reverse_); }
+  void setReverse(bool on)    { setSpeed(rate_, on); }
+
+  // --- Scenes (called by MidiHandler and the scene button) ----
+
+  /// Switch to loop scene `scene` (0..kLoopScenes-1): at the next
+  /// loop boundary while playing or recording, else right away.
+  /// An overdub is committed first.  Selecting the playing scene
+  /// cancels a pending switch.
+  void selectScene(int scene);
+
+  /// Select the scene after the current (or pending) one.
+  void nextScene();
+
+  /// The playing scene.
+  int scene() const { return scene_; }
+
+  // --- Loop transforms (called by MidiHandler) ----------------
+  // Each rewrites every layer of the scene, swapped in on the next
+  // loop boundary (right away when stopped).  One at a time: a
+  // transform arriving while one waits for the boundary is ignored.
+
+  /// Pull note-ons toward each layer's grid (0..1 of the way).
+  void quantiseLoop(float strength);
+
+  /// Random timing and velocity, 0..1 of kHumaniseMaxMs / kHumaniseMaxVel.
+  void humaniseLoop(float amount);
+
+  /// Shift every note (clamped to +-kTransposeMax semitones).
+  void transposeLoop(int semitones);
+
+  /// Multiply note-on velocities.
+  void scaleVelocity(float gain);
+
+  /// Pull velocities 0..1 of the way toward kVelocityCentre.
+  void compressVelocity(float amount);
+
+  // --- MIDI clock transport (called by MidiHandler) -----------
+
+  /// First pulse after a clock Start or Continue: play the loop
+  /// from where the song position falls in it (the top after a
+  /// Start), counting loop cycles from the top of the song.
+  void onClockStart();
+
+  /// Clock Stop: stop playing (an overdub is kept).
+  void onClockStop();
+
+  /// Quantise mode: the base take's length snaps to whole beats
+  /// and each take's notes to a grid.  Applies from the next take.
+  void setQuantise(bool on);
+
   /// Track the current live preset so it can be "frozen" when
-  /// recording starts.  If already recording, the looper synth
-  /// preset is updated immediately.
+  /// recording starts.  Every loop cycle starts on that preset;
+  /// later changes are recorded as events.
   void setLivePreset(int preset);
 
+  // --- Persistence (called by LoopStore) -----------------------
+
+  /// Loop contents for export.  The layers are pinned while the
+  /// snapshot is open, so an undo or overdub during a save cannot
+  /// free them.
+  struct Snapshot {
+    uint8_t   slots[kLoopPoolTracks];
+    int       count  = 0;
+    uint32_t  length = 0;     // loop length, samples
+    uint8_t   preset = 0;     // frozen preset
+    LoopMerge merge;          // every layer's events in time order
+  };
+
+  /// Open a snapshot of the loop; false if there is no loop.
+  bool openSnapshot(Snapshot& snap);
+  void closeSnapshot(Snapshot& snap);
+
+  /// Replace the loop with loaded events: beginImport() (false if
+  /// no pool slot is free), then importEvent() in time order (false
+  /// once the layer is full), then endImport() starts playing it.
+  /// Without a slot, importEvent() and endImport() return false.
+  bool beginImport();
+  bool importEvent(const LoopEvent& ev);
+  void importPreset(int preset);
+  bool endImport(uint32_t length);
+
   /// Query the current state (useful for LED feedback).
   LoopState state() const { return state_; }
 
+  /// Number of layers in the loop (base take + overdubs).
+  int layers() const { return layerCount_; }
+
 private:
   void startRecording();
   void stopRecordingAndPlay();
   void stopPlayback();
+  void startOverdub();
+  void stopOverdub();
+  void rollOverdub(uint32_t now);
+  void commitLayer();
+  void quantiseTake(bool base);
+  void playFromTop(uint32_t start);
+  void nextCycle();
+  void lockCycle();
+  void resyncLayers();
+  void seekLayers(uint32_t pos);
+  uint32_t playPosition() const;
+  uint32_t overdubPosition(uint32_t now, uint32_t& cycle);
+
+  /// This cycle's length on the clock: the loop length, stretched
+  /// when slaved.
+  uint32_t cycleLength() const { return loopLength_ + stretch_; }
+
+  /// Loop position `t` as a clock offset into this cycle, and back.
+  uint32_t toCycle(uint32_t t) const {
+    return stretch_ ? (uint32_t)((uint64_t)t * cycleLength() / loopLength_) : t;
+  }
+  uint32_t toLoop(uint32_t c) const {
+    return stretch_ ? (uint32_t)((uint64_t)c * loopLength_ / cycleLength()) : c;
+  }
+  LoopTrack& layer(int i) { return history_.track(slots_[i]); }
   void clear();
   void killActiveNotes();
-  void addEvent(uint8_t type, uint8_t note, uint8_t vel);
+  void resetLoopControls();
+  void releaseLoopNotes();
+  void wrapLoopNotes();
+  void updateCrossing();
+  void startTail();
+  void captureTail(uint8_t note);
+  void finishTail();
+  void addEvent(uint8_t type, uint8_t note, uint8_t vel, uint8_t fine = 0);
+  void playEvent(const LoopEvent& ev);
+  void playEventsUntil(uint32_t pos);
+  void playEventAt(const LoopEvent& ev, uint32_t offset);
+  void queueControl(const LoopEvent& ev);
+  void flushControls();
+
+  void mergeReset();
+
+  void stageScene(uint8_t scene);
+  void saveScene();
+  void loadScene(uint8_t scene);
+  void switchScene();
+  void enterScene(uint8_t scene);
+  void reportScene();
+
+  void applyTransform(LoopTransform::Params& p, const char* what);
+  void releaseRetired();
 
-  MyDsp& live_;
-  MyDsp& looper_;
+  bool varispeed() const { return rate_ != kRateOne || reverse_; }
+  void runVarispeed(uint32_t samples);
+  void playVarispeed(const LoopEvent& ev, uint32_t offset);
+  uint32_t gatherReverse(uint32_t lo, uint32_t hi);
+  void restartVarispeed(uint32_t start);
+
+  bool playing() const   { return state_ == LOOP_PLAYING || state_ == LOOP_OVERDUB; }
+  bool recording() const { return state_ == LOOP_RECORDING || state_ == LOOP_OVERDUB; }
+
+  MyDsp& synth_;   // loop plays on its PART_LOOP part
 
   LoopState state_ = LOOP_EMPTY;
 
-  // Fixed-size event buffer (no dynamic allocation)
-  LoopEvent events_[kMaxLoopEvents];
-  int       eventCount_ = 0;
+  // Fixed pool of event streams (no dynamic allocation).  slots_
+  // lists the playing scene's layers' pool slots, root first;
+  // recSlot_ is the slot being recorded.
+  LoopHistory history_;
+  uint8_t     slots_[kLoopPoolTracks];
+  int         layerCount_ = 0;
+  uint8_t     recSlot_    = LoopHistory::kNone;
+  uint32_t    recCycle_   = 0;  // overdub pass (a cycles_ value)
+  LoopMerge   merge_;           // playback position in every layer
+
+  // Timing, in AudioClock samples
+  uint32_t recStart_   = 0;
+  uint32_t loopLength_ = 0;    // exact loop length: event times are below it
+  int32_t  stretch_    = 0;    // slaved: this cycle is this much longer on the clock
+  uint32_t playStart_  = 0;    // clock position of the current cycle's start
+  uint32_t cycles_     = 0;    // cycles played since the overdub started
+  uint32_t lastTick_   = 0;    // clock at the last tick(), for Metrics
+
+  // Scenes.  The playing scene's values live in the members
+  // below; scenes_ keeps the others'.  sceneNext_ is the scene
+  // staged for the next loop boundary (nextSlots_ holds its
+  // layers), and sceneEntered_ tells tick() the ISR switched.
+  struct Scene {
+    uint32_t length     = 0;    // 0 = empty
+    uint32_t beat       = 0;
+    uint32_t syncPulses = 0;
+    uint8_t  preset     = 0;
+  };
+  static constexpr uint8_t kNoScene = 0xFF;
+  Scene            scenes_[kLoopScenes];
+  volatile uint8_t scene_        = 0;
+  volatile uint8_t sceneNext_    = kNoScene;
+  volatile bool    sceneEntered_ = false;
+  uint8_t          nextSlots_[kLoopPoolTracks];
+  int              nextCount_    = 0;
+  uint8_t          shownScene_   = 0;    // last scene reported (main thread)
+
+  // Transforms: the layers the ISR may still be playing after a
+  // rewrite, pinned until the next switch.
+  bool    transformPending_ = false;
+  uint8_t retired_[kLoopPoolTracks];
+  int     retiredCount_     = 0;
+
+  // Quantise: beat_ is the loop's beat in samples (0 = none found)
+  bool     quantise_ = kQuantiseDefault;
+  uint32_t beat_     = 0;
+
+  // Speed.  Away from 1x forward, posQ_ is the loop position of
+  // the next sample (Q16.16) and varLast_ the clock time tick()
+  // has played up to; revEvents_ holds one pass of the block's
+  // reversed events, latest first, and revLost_ the notes whose
+  // note-offs did not fit in it.
+  static constexpr uint32_t kRateOne       = 1u << kLoopRateShift;
+  static constexpr int      kReverseWindow = 32;
+  uint32_t  rate_     = kRateOne;
+  bool      reverse_  = false;
+  uint64_t  posQ_     = 0;
+  uint32_t  varLast_  = 0;
+  LoopEvent revEvents_[kReverseWindow];
+  int       revCount_ = 0;
+  NoteSet   revLost_;
+
+  // MIDI clock sync: the loop is syncPulses_ clock pulses long
+  // (0 = free-running) and the current cycle started on pulse
+  // syncPulse_.  recPulse_ is the pulse the recording started on.
+  bool     recSynced_  = false;
+  uint32_t recPulse_   = 0;
+  uint32_t syncPulse_  = 0;
+  uint32_t syncPulses_ = 0;
+
+  // Replayed controller events waiting to be applied, one slot per
+  // ParamId plus bend and pressure (last value wins).  ctlAt_ is
+  // the block offset of the latest one.
+  static constexpr uint8_t CTL_BEND     = PARAM_COUNT;
+  static constexpr uint8_t CTL_PRESSURE = PARAM_COUNT + 1;
+  static constexpr uint8_t CTL_COUNT    = PARAM_COUNT + 2;
+  static_assert(CTL_COUNT <= 32, "ctlDirty_ is a 32-bit mask");
+  LoopEvent ctlEvent_[CTL_COUNT] = {};
+  uint32_t  ctlDirty_ = 0;
+  uint32_t  ctlAt_    = 0;
 
-  // Timing
-  uint32_t recStartMs_   = 0;
-  uint32_t loopLengthMs_ = 0;
-  uint32_t playStartMs_  = 0;
-  int      playIndex_    = 0;
+  // Track which notes PART_LOOP currently has sounding, so we
+  // can kill them cleanly on state transitions.  crossing_ holds
+  // the notes the playing layers carry across the loop point.
+  NoteSet sounding_;
+  NoteSet crossing_;
 
-  // Track which notes the looper synth currently has sounding,
-  // so we can kill them cleanly on state transitions.
-  bool notesOn_[128] = {};
+  // Loop-point tail: recHeld_ are the keys held in the take being
+  // recorded.  Once it is committed, the note-offs of tailNotes_
+  // are caught into tail_ (in time order) until tailEnd_, then
+  // merged into layer tailSlot_ of scene tailScene_.
+  static constexpr int kTailNotes = 16;
+  NoteSet   recHeld_;
+  NoteSet   tailNotes_;
+  LoopEvent tail_[kTailNotes];
+  int       tailCount_ = 0;
+  uint8_t   tailSlot_  = LoopHistory::kNone;
+  uint8_t   tailScene_ = 0;
+  uint32_t  tailEnd_   = 0;
 
   // Preset freeze: the live preset is tracked continuously;
-  // it gets "frozen" into the looper synth at record start.
+  // it gets "frozen" into PART_LOOP at record start.
   int livePreset_   = 0;
   int frozenPreset_ = 0;
 };
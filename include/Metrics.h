@@ -0,0 +1,93 @@
+#pragma once
+// ============================================================
+// Metrics.h -- Runtime load counters and their reports
+//
+// What is measured, and where:
+//   - MyDsp::update(): cycles per block on ARM_DWT_CYCCNT (min,
+//     max, and a histogram in 1/kMetricsBuckets of the block
+//     period), plus the Audio library's AudioProcessorUsageMax()
+//     and AudioMemoryUsageMax()
+//   - loop(): cycles per Scheduler pass (max and mean)
+//   - MidiHandler: messages per second (over the last second)
+//   - MyDsp::noteOn(): voices stolen
+//   - Looper::tick(): how late it ran.  Playing from the audio
+//     ISR, events are sample-exact and this is the time past one
+//     block since the last tick; playing from tick(), it is how
+//     late the first due event plays.
+//
+// Reports, on request:
+//   SysEx  F0 7D 4D 01 F7  ->  F0 7D 4D 02 <ver> <fields> F7
+//          F0 7D 4D 03 F7      reset the maxima and counts
+//   Serial '?'  text report (through Log),  'r'  reset
+//
+// Each reply field is a uint32 as five 7-bit bytes, low first,
+// in MetricField order.
+//
+// audioBlock() and voiceStolen() may run in the audio ISR;
+// everything else is main-thread only.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+/// Fields of the SysEx reply, in order.
+enum MetricField : uint8_t {
+  METRIC_BLOCKS = 0,          // audio blocks timed since the reset
+  METRIC_BLOCK_MIN,           // cycles
+  METRIC_BLOCK_MAX,           // cycles
+  METRIC_BLOCK_PERIOD,        // cycles in one block at the current clock
+  METRIC_CPU_MAX,             // AudioProcessorUsageMax(), 1/100 %
+  METRIC_MEM_MAX,             // AudioMemoryUsageMax(), blocks
+  METRIC_LOOP_MAX_US,
+  METRIC_LOOP_MEAN_US,
+  METRIC_MIDI_PER_S,
+  METRIC_STEALS,
+  METRIC_LOOPER_LATE_MAX_US,
+  METRIC_HIST,                // kMetricsBuckets block counts follow
+  METRIC_FIELDS = METRIC_HIST + kMetricsBuckets
+};
+
+namespace Metrics {
+
+constexpr uint8_t kVersion = 1;
+
+/// Measure the block period at the running clock.  Call once in
+/// setup(); until then the nominal F_CPU period is used.
+void begin();
+
+// --- Counters --------------------------------------------------
+
+/// One MyDsp::update() took `cycles`.  Audio ISR.
+void audioBlock(uint32_t cycles);
+
+/// A note took a voice that was still sounding.  ISR-safe.
+void voiceStolen();
+
+/// One loop() pass took `cycles`.
+void loopPass(uint32_t cycles);
+
+/// One MIDI message arrived.
+void midiMessage();
+
+/// Looper::tick() ran `samples` late.
+void looperLate(uint32_t samples);
+
+// --- Reports ---------------------------------------------------
+
+/// Handle a SysEx message (F0 .. F7); ignores any not for us.
+void onSysEx(const uint8_t* data, uint16_t len);
+
+/// Roll the MIDI rate over and answer serial requests.
+/// Call from loop().
+void poll();
+
+/// Current values, in MetricField order.
+void read(uint32_t* fields);
+
+/// Human-readable report.
+void report(Print& out);
+
+/// Start every maximum and count over.
+void reset();
+
+}  // namespace Metrics
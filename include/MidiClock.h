@@ -0,0 +1,95 @@
+#pragma once
+// ============================================================
+// MidiClock.h -- MIDI clock in (slave) and out (master)
+//
+// Slave: incoming pulses (24 per quarter note) are timestamped
+// on the AudioClock and fitted, by least squares over the last
+// kClockFitPulses, to a straight line
+//
+//     time(pulse n) = refTime + (n - refIndex) * period
+//
+// which filters out USB and main-loop jitter.  The looper asks
+// the fit where future pulses will land, so loop cycles start on
+// the clock's beats with sample accuracy.  Pulses are numbered
+// from the top of the song: pulse 0 is the first one after a
+// Start (0xFA); after a Continue (0xFB) the count resumes from
+// the Song Position (0xF2), or from where the clock stopped.
+//
+// Master: pulses are scheduled on the AudioClock from the loop's
+// start and beat, and sent to the PC port by poll(); the loop's
+// own start and stop are sent as Start / Stop.  A loop that plays
+// again after a stop is sent as Song Position + Continue instead,
+// the position being where the loop resumes in its cycle.
+//
+// The fit is written by the main thread with interrupts off, so
+// pulseTime() is safe in the audio ISR.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+namespace MidiClock {
+
+constexpr uint32_t kPulsesPerBeat = 24;
+
+/// Start in kClockModeDefault.  Call once in setup().
+void begin();
+
+void      setMode(ClockMode mode);
+ClockMode mode();
+
+// --- Slave (called by MidiHandler) -----------------------------
+
+/// Count one clock pulse (0xF8).  True if it is the first pulse
+/// after a Start or Continue (slave mode only): the transport
+/// starts on pulse startPulse().
+bool onPulse();
+
+/// Start (0xFA): the next pulse is pulse 0.
+void onStart();
+
+/// Continue (0xFB): the next pulse is the song position, without
+/// going back to pulse 0.
+void onContinue();
+
+/// Song Position (0xF2), in sixteenth notes: where the next
+/// Continue resumes.
+void onSongPosition(uint16_t sixteenths);
+
+/// The pulse the transport last started on: 0 after a Start, the
+/// song position after a Continue.
+uint32_t startPulse();
+
+/// Stop (0xFC).  True in slave mode.
+bool onStop();
+
+/// True while slaved to a clock that is running.
+bool running();
+
+/// Beat length in samples, or 0 when not running.
+uint32_t beat();
+
+/// Predicted AudioClock time of pulse `index`.  ISR-safe.
+uint32_t pulseTime(uint32_t index);
+
+/// The beat pulse (a multiple of 24) nearest to `time`.
+uint32_t nearestBeat(uint32_t time);
+
+/// Time of the last pulse received.
+uint32_t lastPulse();
+
+// --- Master ----------------------------------------------------
+
+/// The loop starts a cycle from the top at `start` with this beat
+/// (0: kClockMasterBpm).  Sends Start, or Continue if the loop was
+/// stopped, and re-phases the pulses.
+void loopStarted(uint32_t start, uint32_t beat);
+
+/// The loop stopped: send Stop (the pulses keep running).
+void loopStopped();
+
+/// Send due pulses (master) and notice a lost clock (slave).
+/// Call every loop().
+void poll();
+
+}  // namespace MidiClock
@@ -3,25 +3,41 @@
 // MidiHandler.h -- USB MIDI message routing
 //
 // Reads incoming USB MIDI messages and dispatches them:
-//   - NoteOn / NoteOff  → live synth  (+ looper if recording)
+//   - NoteOn / NoteOff  → channel's synth part
 //   - ProgramChange     → preset selection
-//   - ControlChange     → volume, echo parameters
+//   - PitchBend / ChannelPressure → channel part modulation
+//   - ControlChange     → parameters via the ParamMap CC table
+//   - Clock / Start / Stop → MidiClock, and the looper's transport
+// All of them are also recorded by the looper while it records.
 //
 // Implemented as a namespace with free functions rather than a
-// class, because there is no meaningful per-instance state --
-// the handler simply routes messages between existing objects.
+// class, because there is only ever one handler.  Its only state
+// is the per-channel 14-bit CC / NRPN decoder and each channel's
+// preset, kept file-static.
 // ============================================================
 
+#include <Arduino.h>
+
 class MyDsp;
 class Looper;
 
 namespace MidiHandler {
 
-/// Register the synth and looper instances.  Call once in setup().
-void begin(MyDsp& liveSynth, MyDsp& looperSynth, Looper& looper);
+/// Register the synth engine and looper.  Call once in setup().
+void begin(MyDsp& synth, Looper& looper);
 
 /// Process one pending MIDI message.
 /// Call inside: while (usbMIDI.read()) { MidiHandler::process(); }
 void process();
 
+/// Send a normalised parameter value to the parts in its target
+/// mask, exactly as a CC for it on channel part `part` would.
+void applyParam(uint8_t part, uint8_t id, float x01);
+
+/// Select a preset for `part`, as a Program Change would.
+void programChange(uint8_t part, uint8_t program);
+
+/// Last preset selected for `part` (0..3).
+int preset(uint8_t part);
+
 }  // namespace MidiHandler
@@ -4,10 +4,18 @@
 //
 // Inherits from AudioStream (Teensy Audio Library) to produce
 // real-time audio.  Features:
-//   - 8-voice polyphony with oldest-voice stealing
+//   - Multi-timbral: kParts logical parts (one per MIDI channel,
+//     plus PART_LOOP for the looper) share one pool of kVoices
+//     voices with oldest-voice stealing across all parts
 //   - ADSR envelope per voice
-//   - 4 timbres (presets): sine, additive, electric, pad
+//   - 4 timbres (presets): sine, additive, electric, pad, with a
+//     continuous per-part morph toward the next preset
 //   - Global mono echo effect (ring-buffer delay)
+//   - Per-part pitch bend and channel pressure, applied once per block
+//   - Per-part sustain (CC64) and sostenuto (CC66) pedals
+//
+// A voice latches its part's preset and gain at noteOn(), so a
+// program change or volume move only affects notes played after it.
 //
 // IMPORTANT: update() runs inside the audio ISR at ~345 Hz.
 // All public setters are called from loop() (main thread) and
@@ -18,6 +26,7 @@
 #include <Audio.h>
 #include <Arduino.h>
 #include "config.h"
+#include "NoteSet.h"
 
 class MyDsp : public AudioStream {
 public:
@@ -29,11 +38,35 @@ public:
   /// samples by mixing all active voices through the echo effect.
   void update(void) override;
 
+  // --- Sample-accurate scheduling (audio ISR) ------------------
+
+  /// Called at the top of every update() with the AudioClock index
+  /// of the block's first sample.  Runs in the audio ISR: it must
+  /// not print or block.
+  using BlockCallback = void (*)(uint32_t blockStart);
+  void setBlockCallback(BlockCallback cb);
+
+  /// Only from inside the block callback: render the block up to
+  /// sample `offset` (0..AUDIO_BLOCK_SAMPLES), so that the note or
+  /// parameter change applied next starts exactly at that sample.
+  void renderTo(int offset);
+
   // --- MIDI-driven controls (called from loop context) ---------
-  void noteOn(uint8_t note, uint8_t vel);
-  void noteOff(uint8_t note);
+  // `part` is 0..kParts-1: a MIDI channel (0-based) or PART_LOOP.
+  void noteOn(uint8_t part, uint8_t note, uint8_t vel);
+  void noteOff(uint8_t part, uint8_t note);
+
+  void setPitchBend(uint8_t part, int bend);   // -8192..8191 (14-bit, centred)
+  void setPressure(uint8_t part, float p);     // 0..1 (channel aftertouch)
+
+  void setSustain(uint8_t part, bool down);
+  void setSostenuto(uint8_t part, bool down);
+
+  void setPreset(uint8_t part, int p);         // 0..3
+  void setMorph(uint8_t part, float m);        // 0..1 toward preset p+1
+  void setPartGain(uint8_t part, float g);     // 0..1
 
-  void setPreset(int p);            // 0..3
+  // --- Engine-wide controls -------------------------------------
   void setMasterGain(float g);      // 0..1
 
   void setEchoOn(bool on);
@@ -58,8 +91,33 @@ private:
   /// Look up the sine table using a normalised phase in [0, 1).
   float sineFromPhase(float phase01) const;
 
+  // Pitch-bend ratio table: 2^(semitones/12) sampled at 129 points
+  // across the full 14-bit bend range.  setPitchBend() interpolates
+  // it, so no powf() is ever evaluated per bend message or sample.
+  static constexpr int kBendTableSize = 128;
+  static float         sBendTable[kBendTableSize + 1];
+  static void          initBendTable();
+
   // ---------- Per-voice structures -----------------------------
 
+  /// A preset expressed as data for the single voice kernel:
+  /// a few sine partials plus noise and low-pass amounts.  Two
+  /// adjacent presets are blended into one Timbre per voice per
+  /// block, so morphing adds no per-sample cost.
+  struct Timbre {
+    static constexpr int kMaxPartials = 6;
+    int   count = 0;
+    float ratio[kMaxPartials];    // partial frequency / fundamental
+    float weight[kMaxPartials];
+    float noise = 0.0f;           // transient noise depth ("electric")
+    float lpMix = 0.0f;           // 0 = dry, 1 = fully low-passed ("pad")
+  };
+
+  static const Timbre kPresetTimbres[4];
+
+  /// Blend preset `a` toward preset `b` by t in [0, 1].
+  static void blendTimbres(const Timbre& a, const Timbre& b, float t, Timbre& out);
+
   /// Simple one-pole low-pass filter used by the "pad" preset.
   struct OnePoleLP {
     float z = 0.0f;
@@ -74,6 +132,9 @@ private:
   struct Voice {
     bool     active   = false;
     uint8_t  note     = 0;
+    uint8_t  part     = 0;       // owning part (MIDI channel or PART_LOOP)
+    uint8_t  preset   = 0;       // part preset latched at noteOn()
+    float    gain     = 1.0f;    // part gain latched at noteOn()
     uint32_t age      = 0;       // used by voice-stealing (oldest = smallest)
 
     float phase    = 0.0f;       // oscillator phase in [0, 1)
@@ -95,8 +156,63 @@ private:
   /// Steal the oldest active voice (smallest age value).
   int stealVoice() const;
 
+  // ---------- Per-part state -----------------------------------
+
+  /// One logical instrument layered onto the shared voice pool.
+  struct Part {
+    uint8_t preset    = 0;
+    float   morph     = 0.0f;    // 0..1 toward preset + 1 (live, not latched)
+    float   gain      = 0.5f;    // same level as the former 0.5 mixer input
+
+    // Performance modulation, read once per voice per block
+    float   bendRatio = 1.0f;    // phaseInc multiplier from pitch bend
+    float   pressure  = 0.0f;    // channel pressure [0..1]
+
+    bool    sustainDown   = false;
+    bool    sostenutoDown = false;
+    NoteSet keysDown;            // keys physically held
+    NoteSet sostenutoHeld;       // keys latched when sostenuto went down
+    NoteSet deferred;            // released keys still held by a pedal
+  };
+
+  Part parts[kParts];
+
+  // ---------- Note / pedal bookkeeping -------------------------
+  // noteVoices[n] has bit v set while voice v plays note n (any
+  // part); partVoices[p] has bit v set while voice v belongs to
+  // part p.  Their AND gives one part's voices for a note, so a
+  // note-off touches only its own voices, and a pedal release
+  // sweeps just the deferred notes with ctz.
+  static_assert(kVoices <= 32, "voice masks are 32-bit");
+  uint32_t noteVoices[128]   = {};
+  uint32_t partVoices[kParts] = {};
+
+  /// Put every voice of `part` playing a note of `notes` into
+  /// RELEASE.  Caller must hold the IRQ lock.
+  void releaseNotes(uint8_t part, NoteSet notes);
+
+  /// Drop voice `i` from the note/part masks.  Caller must hold
+  /// the IRQ lock (or be the ISR).
+  void unlinkVoice(int i);
+
+  // ---------- Voice kernels (ISR) ------------------------------
+
+  /// Per-sample ADSR increments, computed once per block.
+  struct EnvRates { float atk, dec, rel; };
+
+  inline bool stepEnvelope(Voice& voice, const EnvRates& r);
+
+  /// Render `n` samples of one voice with the shared kernel.
+  bool renderVoice(Voice& voice, const Timbre& tb, float* mix, int n,
+                   float inc, float amp, const EnvRates& r);
+
+  // ---------- Block rendering state (ISR) ----------------------
+  float         mixBus[AUDIO_BLOCK_SAMPLES];
+  int           renderPos     = 0;        // samples of mixBus already rendered
+  EnvRates      blockRates    = {};
+  BlockCallback blockCallback = nullptr;
+
   // ---------- Global parameters --------------------------------
-  int   preset     = 0;
   float masterGain = 0.35f;
 
   // Echo parameters
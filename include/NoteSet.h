@@ -0,0 +1,57 @@
+#pragma once
+// ============================================================
+// NoteSet.h -- 128-bit set of MIDI note numbers
+//
+// Four 32-bit words, one bit per note.  Set operations are a
+// handful of word ops, and iteration visits only the notes that
+// are present by peeling the lowest set bit with
+// count-trailing-zeros -- no loop over all 128 notes.
+//
+// Usage:
+//   NoteSet s;  s.set(60);  s.set(64);
+//   for (int n = s.popLowest(); n >= 0; n = s.popLowest()) { ... }
+// ============================================================
+
+#include <stdint.h>
+
+struct NoteSet {
+  uint32_t w[4] = {0, 0, 0, 0};
+
+  void set(uint8_t n)        { w[(n >> 5) & 3] |=  (1u << (n & 31)); }
+  void reset(uint8_t n)      { w[(n >> 5) & 3] &= ~(1u << (n & 31)); }
+  bool test(uint8_t n) const { return (w[(n >> 5) & 3] >> (n & 31)) & 1u; }
+
+  bool any() const   { return (w[0] | w[1] | w[2] | w[3]) != 0; }
+  void clear()       { w[0] = w[1] = w[2] = w[3] = 0; }
+
+  /// Remove and return the lowest note in the set, or -1 if empty.
+  int popLowest() {
+    for (int i = 0; i < 4; i++) {
+      if (w[i]) {
+        int bit = __builtin_ctz(w[i]);
+        w[i] &= w[i] - 1;          // clear lowest set bit
+        return (i << 5) | bit;
+      }
+    }
+    return -1;
+  }
+
+  NoteSet operator|(const NoteSet& o) const {
+    NoteSet r;
+    for (int i = 0; i < 4; i++) r.w[i] = w[i] | o.w[i];
+    return r;
+  }
+
+  NoteSet operator&(const NoteSet& o) const {
+    NoteSet r;
+    for (int i = 0; i < 4; i++) r.w[i] = w[i] & o.w[i];
+    return r;
+  }
+
+  /// Members of this set that are not in `o`.
+  NoteSet minus(const NoteSet& o) const {
+    NoteSet r;
+    for (int i = 0; i < 4; i++) r.w[i] = w[i] & ~o.w[i];
+    return r;
+  }
+};
@@ -0,0 +1,45 @@
+#pragma once
+// ============================================================
+// Panel.h -- Control panel gestures and key bindings
+//
+// Turns ButtonMatrix key changes into gestures and runs the
+// action bound to each one in a const table (Panel.cpp):
+//
+//   SHORT   pressed and released before kPanelLongMs
+//   LONG    held for kPanelLongMs (fires while still held)
+//   DOUBLE  pressed again within kDoubleTapMs of a release
+//   COMBO   pressed while another key is held
+//
+// A key only waits for a second tap, or for the long-press time,
+// if it has a DOUBLE or LONG binding; otherwise its short press
+// fires at once on release.  Keys used in a combo fire nothing
+// else when they are released.  All timing is integer ms.
+//
+// Actions go through the same paths as MIDI (MidiHandler's
+// programChange() / applyParam(), Looper, MidiClock), so a key
+// does what the matching message would, recording included.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+class MyDsp;
+class Looper;
+
+namespace Panel {
+
+enum Gesture : uint8_t {
+  GESTURE_SHORT = 0,
+  GESTURE_LONG,
+  GESTURE_DOUBLE,
+  GESTURE_COMBO
+};
+
+/// Register the synth and looper and start the matrix scan.
+/// Call once in setup(), after MidiHandler::begin().
+void begin(MyDsp& synth, Looper& looper);
+
+/// Handle queued key changes and due gestures.  Call from loop().
+void poll();
+
+}  // namespace Panel
@@ -0,0 +1,113 @@
+#pragma once
+// ============================================================
+// ParamMap.h -- Table-driven MIDI CC → synth parameter mapping
+//
+// Every controllable synth parameter is described once in a
+// descriptor table (name, default CC, range, curve, and which
+// synth parts it applies to).  A 128-entry lookup table maps each
+// CC number straight to a descriptor, so dispatch in
+// MidiHandler is a single array access instead of an if-chain.
+//
+// MIDI learn: send CC_MIDI_LEARN with the parameter index as
+// value, then move any knob -- the next CC received is bound
+// to that parameter.  The map is saved to EEPROM and reloaded
+// at boot, so controllers can be remapped without reflashing.
+//
+// Parameters can also be addressed at 14-bit resolution with
+// NRPN (MSB = kNrpnParamMsb, LSB = ParamId) + data entry.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+class MyDsp;
+
+// --- Parameter identifiers (index into the descriptor table) ---
+
+enum ParamId : uint8_t {
+  PARAM_MASTER_VOL = 0,
+  PARAM_ECHO_ON,
+  PARAM_ECHO_MIX,
+  PARAM_ECHO_FB,
+  PARAM_ECHO_MS,
+  PARAM_SUSTAIN,
+  PARAM_SOSTENUTO,
+  PARAM_TIMBRE,
+  PARAM_COUNT
+};
+
+constexpr uint8_t PARAM_NONE = 0xFF;   // CC not bound to anything
+
+/// How a normalised controller value [0, 1] maps onto [lo, hi].
+enum ParamCurve : uint8_t {
+  CURVE_LINEAR = 0,     // lo + x * (hi - lo)
+  CURVE_EXP,            // lo * (hi / lo)^x  (lo must be > 0)
+  CURVE_SWITCH          // lo below half-way, hi at or above it
+};
+
+/// Which synth parts a parameter is sent to (bit mask).
+/// TARGET_LIVE is the part of the MIDI channel the CC arrived on,
+/// TARGET_LOOPER is PART_LOOP.  TARGET_GLOBAL parameters are
+/// engine-wide and applied once (the part argument is ignored).
+/// TARGET_RECORD also captures the move into the loop while the
+/// looper is recording, so it replays with the loop's notes.
+enum ParamTarget : uint8_t {
+  TARGET_LIVE   = 0x01,
+  TARGET_LOOPER = 0x02,
+  TARGET_BOTH   = TARGET_LIVE | TARGET_LOOPER,
+  TARGET_RECORD = 0x04,
+  TARGET_GLOBAL = 0x08
+};
+
+/// Static description of one controllable parameter.
+struct ParamDesc {
+  const char* name;
+  uint8_t     defaultCc;
+  ParamCurve  curve;
+  float       lo;
+  float       hi;
+  uint8_t     targets;                                     // ParamTarget mask
+  void      (*apply)(MyDsp& dsp, uint8_t part, float v);   // v already scaled to [lo, hi]
+};
+
+namespace ParamMap {
+
+/// Load the CC map from EEPROM (or fall back to the defaults
+/// from config.h if the stored map is missing or stale).
+void begin();
+
+/// Descriptor for a parameter id (must be < PARAM_COUNT).
+const ParamDesc& desc(uint8_t id);
+
+/// Map a normalised value [0, 1] through the descriptor's curve.
+float scale(const ParamDesc& d, float x01);
+
+// --- MIDI learn ------------------------------------------------
+
+/// Arm learn mode for parameter `id`.  Values >= PARAM_COUNT
+/// cancel learn mode; 127 restores the default map.
+void armLearn(uint8_t id);
+
+/// True while waiting for the CC to bind.
+bool learning();
+
+/// Bind `cc` to the armed parameter, save to EEPROM, and leave
+/// learn mode.  Returns false if learn mode was not armed.
+bool learn(uint8_t cc);
+
+/// Restore the default bindings from config.h and save them.
+void resetDefaults();
+
+// --- Dispatch ---------------------------------------------------
+
+/// The 128-entry CC table (defined in ParamMap.cpp).
+extern uint8_t gCcToParam[128];
+
+/// O(1) lookup: parameter bound to a CC, or PARAM_NONE.
+inline uint8_t paramForCc(uint8_t cc) { return gCcToParam[cc & 0x7F]; }
+
+/// Parameter whose config.h default is `cc`, ignoring MIDI learn
+/// (used for MIDI files, which should not depend on one setup).
+uint8_t paramForDefaultCc(uint8_t cc);
+
+}  // namespace ParamMap
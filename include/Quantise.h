@@ -0,0 +1,42 @@
+#pragma once
+// ============================================================
+// Quantise.h -- Tempo detection and grid snapping for loop takes
+//
+// The beat comes from a MIDI clock when one is followed (see
+// MidiClock.h); otherwise inferBeat() finds it in the take's own
+// note onsets.  Intervals between each onset and its next few
+// neighbours go into a histogram; the beat is the bin that,
+// together with its multiples and its half, collects the most
+// intervals, refined by a least-squares fit of the onsets to a
+// half-beat grid.
+//
+// chooseDivision() then picks, for each take, the coarsest grid
+// (1, 2, 3, 4, 6 or 8 steps per beat) the take's notes fit, and
+// apply() rewrites the take with its note-ons on that grid.
+// Note-offs move with their note-on, so every note keeps its
+// length.  All times are AudioClock samples from the loop top,
+// which is always on a beat.
+// ============================================================
+
+#include <Arduino.h>
+#include "LoopTrack.h"
+
+namespace Quantise {
+
+/// Beat length in samples inferred from the take's note onsets,
+/// or 0 if they show no clear pulse.
+uint32_t inferBeat(const LoopTrack& take);
+
+/// `length` rounded to a whole number of beats (at least one).
+uint32_t snapLength(uint32_t length, uint32_t beat);
+
+/// Grid steps per beat that the take's note-ons fit, or 0 if none
+/// fits well enough (kGridFit) -- the take is then left as played.
+int chooseDivision(const LoopTrack& take, uint32_t beat);
+
+/// Copy `in` to `out` with note-ons on the beat/div grid (div 0:
+/// times unchanged), dropping events played at or after `length`
+/// (see LoopTransform::apply()).  False if `out` ran out of room.
+bool apply(const LoopTrack& in, LoopTrack& out, uint32_t beat, int div, uint32_t length);
+
+}  // namespace Quantise
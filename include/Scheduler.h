@@ -0,0 +1,68 @@
+#pragma once
+// ============================================================
+// Scheduler.h -- Cooperative, prioritised main-loop tasks
+//
+// loop() is one call to run(), a pass over a table of tasks in
+// priority order (index 0 first).  Each task does one bounded
+// slice of work per call and says whether it has more:
+//
+//   - Every task is due once per pass.  After each slice the
+//     highest-priority due task runs next, so a task with more
+//     work (MIDI still queued) goes again before anything below.
+//   - A task with more work is due again only while the pass is
+//     under kSchedPassUs; after that it waits for the next pass.
+//     That is how long jobs (SD writes, the log) are cut into
+//     resumable slices without holding up MIDI.
+//   - A `deferrable` task is skipped in a pass that is already
+//     over kSchedPassUs, unless its deadline has come.
+//
+// Per task: a budget (longest slice expected) and a deadline
+// (longest wait expected between slices).  Slices over budget
+// and waits past the deadline are counted, and report() lists
+// any new ones now and then, so a stage starving another shows
+// up on the log instead of as a glitch.
+// ============================================================
+
+#include <Arduino.h>
+#include "config.h"
+
+namespace Scheduler {
+
+/// One slice of work.  True if the task has more to do now.
+using TaskFn = bool (*)();
+
+/// A task: its name, slice function, limits and counters.
+struct Task {
+  const char* name;
+  TaskFn      run;
+  uint32_t    budgetUs;     // longest slice expected
+  uint32_t    deadlineUs;   // longest wait expected between slices
+  bool        deferrable;   // may sit out a pass that is over time
+
+  // Filled in by the scheduler.
+  uint32_t slices      = 0;
+  uint32_t overBudget  = 0;   // slices longer than budgetUs
+  uint32_t missed      = 0;   // waits longer than deadlineUs
+  uint32_t maxUs       = 0;   // longest slice
+  uint32_t maxWaitUs   = 0;   // longest wait between slices
+  uint32_t lastUs      = 0;   // micros() at the start of the last slice
+  uint32_t shownOver   = 0;   // overBudget / missed at the last report
+  uint32_t shownMissed = 0;
+  bool     due         = false;
+};
+
+/// Use `tasks` (highest priority first).  Call once in setup().
+void begin(Task* tasks, int count);
+
+/// One pass over the tasks.  Call from loop(), and nothing else.
+void run();
+
+/// Print any limits broken since the last report to `out`.
+/// run() calls it every kSchedReportMs.
+void report(Print& out);
+
+/// Task `i` with its counters.
+const Task& task(int i);
+int         taskCount();
+
+}  // namespace Scheduler
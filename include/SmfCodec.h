@@ -0,0 +1,123 @@
+#pragma once
+// ============================================================
+// SmfCodec.h -- Standard MIDI File (type 0) writer and reader
+//
+// Plain C++ with no Arduino dependency, so the same code builds
+// on the host for testing against real files:
+//
+//   g++ -std=c++17 -Iinclude -c src/SmfCodec.cpp
+//
+// Event times are in audio samples; the codec converts them to
+// and from file ticks using the sample rate, the division and
+// the tempo.
+//
+// SmfWriter is a pull-based stream: read() fills a caller buffer
+// with the next few hundred bytes, so a save can be spread over
+// many loop() iterations.  The MTrk length is only known at the
+// end; patch it in at kTrackLengthOffset once read() returns 0.
+//
+// SmfReader pulls bytes through a callback and returns channel
+// events one by one.  It follows running status and tempo
+// changes and skips meta/SysEx events.
+// ============================================================
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// One channel message at a time in samples.
+struct SmfEvent {
+  uint32_t time;        // samples from the start of the file
+  uint8_t  status;      // 0x80..0xEF, channel in the low nibble
+  uint8_t  data1;
+  uint8_t  data2;       // unused for 0xC0/0xD0 messages
+};
+
+/// Time base shared by the writer and the reader.
+struct SmfTiming {
+  double   sampleRate;
+  uint16_t division;        // ticks per quarter note
+  uint32_t usPerQuarter;    // tempo (writer: stored in the file)
+};
+
+// --- Writer ----------------------------------------------------
+
+class SmfWriter {
+public:
+  /// Pull the next event in time order; false when there are none.
+  using NextFn = bool (*)(void* ctx, SmfEvent& ev);
+
+  /// Byte offset of the 4-byte big-endian MTrk length.
+  static constexpr uint32_t kTrackLengthOffset = 18;
+
+  /// Start a file.  `endTime` (samples) places End of Track, which
+  /// is how the loop length survives the round trip.
+  void begin(const SmfTiming& timing, uint32_t endTime, NextFn next, void* ctx);
+
+  /// Copy up to `cap` bytes of the file into `out`.  Returns the
+  /// number written; 0 once the whole file has been produced.
+  size_t read(uint8_t* out, size_t cap);
+
+  bool done() const { return phase_ == PHASE_DONE && pendPos_ == pendLen_; }
+
+  /// Final MTrk length as it belongs at kTrackLengthOffset.
+  void trackLengthBytes(uint8_t out[4]) const;
+
+private:
+  enum Phase : uint8_t { PHASE_HEADER, PHASE_EVENTS, PHASE_END, PHASE_DONE };
+
+  void     produce();
+  void     putDelta(uint32_t time);
+  uint32_t toTicks(uint32_t time) const;
+
+  SmfTiming timing_    = {};
+  uint32_t  endTime_   = 0;
+  NextFn    next_      = nullptr;
+  void*     ctx_       = nullptr;
+  Phase     phase_     = PHASE_DONE;
+  uint32_t  lastTick_  = 0;
+  uint32_t  trackLen_  = 0;     // bytes written after the MTrk header
+
+  uint8_t   pend_[32];          // bytes of the current item
+  uint8_t   pendLen_   = 0;
+  uint8_t   pendPos_   = 0;
+};
+
+// --- Reader ----------------------------------------------------
+
+class SmfReader {
+public:
+  /// Next byte of the file, or -1 at end of file.
+  using ReadFn = int (*)(void* ctx);
+
+  /// Parse the header and find the track.  Accepts format 0, or
+  /// format 1 with a single track, at a PPQ division.
+  bool begin(ReadFn read, void* ctx, double sampleRate);
+
+  /// Next channel event; false at End of Track or on error.
+  bool next(SmfEvent& ev);
+
+  /// Time of End of Track in samples (valid once next() is false).
+  uint32_t endTime() const { return toSamples(); }
+
+  bool error() const { return error_; }
+
+private:
+  int      byte();
+  uint32_t readVlq();
+  uint32_t readBe(int n);
+  void     skip(uint32_t n);
+  uint32_t toSamples() const;
+
+  ReadFn   read_       = nullptr;
+  void*    ctx_        = nullptr;
+  double   sampleRate_ = 44100.0;
+  uint16_t division_   = 96;
+  uint32_t tempo_      = 500000;    // µs per quarter (MIDI default)
+  uint32_t left_       = 0;         // bytes left in the track
+  uint8_t  status_     = 0;         // running status
+  bool     error_      = false;
+  bool     ended_      = true;
+
+  // Elapsed time in µs * division: exact across tempo changes
+  uint64_t usTicks_    = 0;
+};
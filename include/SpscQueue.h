@@ -0,0 +1,52 @@
+#pragma once
+// ============================================================
+// SpscQueue.h -- Lock-free queue from one interrupt to loop()
+//
+// A fixed ring of N entries (N a power of two) with exactly one
+// producer, normally a timer ISR, and one consumer, the main
+// thread.  The producer is the only writer of head_ and the
+// consumer the only writer of tail_; both only ever increase
+// (wrapping), so neither side has to mask interrupts.  An entry
+// is filled before head_ moves past it, and a full queue drops
+// the new entry rather than overwrite one being read.
+// ============================================================
+
+#include <Arduino.h>
+
+template <typename T, int N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "queue length must be a power of two");
+
+public:
+  /// Producer side.  False (and counted) if the queue was full.
+  bool push(const T& item) {
+    uint32_t head = head_;
+    if (head - tail_ >= (uint32_t)N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    __asm__ volatile("" ::: "memory");   // entry written before it is published
+    head_ = head + 1;
+    return true;
+  }
+
+  /// Consumer side: take the oldest entry; false if empty.
+  bool pop(T& item) {
+    uint32_t tail = tail_;
+    if (tail == head_) return false;
+    __asm__ volatile("" ::: "memory");   // read the entry after seeing it published
+    item  = items_[tail & (N - 1)];
+    tail_ = tail + 1;
+    return true;
+  }
+
+  /// Entries lost because the queue was full.
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  T                 items_[N];
+  volatile uint32_t head_    = 0;
+  volatile uint32_t tail_    = 0;
+  volatile uint32_t dropped_ = 0;
+};
@@ -10,7 +10,19 @@
 #include <Arduino.h>
 
 // --- Polyphony -------------------------------------------------
-constexpr int kVoices = 8;
+// One shared voice pool for every part (was 2 x 8 voices when the
+// live and looper synths were separate engines).
+constexpr int kVoices = 16;
+
+// --- Parts (multi-timbral layers in the single MyDsp engine) ---
+constexpr int     kMidiParts = 16;           // one part per MIDI channel
+constexpr uint8_t PART_LOOP  = kMidiParts;   // looper playback layer
+constexpr int     kParts     = kMidiParts + 1;
+
+// --- Pitch bend / channel pressure -----------------------------
+constexpr int   kBendRangeSemis = 2;      // ± semitones at full bend
+constexpr float kPressureGain   = 0.5f;   // extra gain at full pressure
+constexpr float kPressureBright = 0.4f;   // pad filter opening at full pressure
 
 // --- MIDI Control Change numbers (match external controller) ---
 constexpr int CC_MASTER_VOL = 7;
@@ -18,16 +30,174 @@ constexpr int CC_ECHO_ON    = 80;
 constexpr int CC_ECHO_MIX   = 91;
 constexpr int CC_ECHO_FB    = 93;
 constexpr int CC_ECHO_MS    = 94;
+constexpr int CC_SUSTAIN    = 64;
+constexpr int CC_SOSTENUTO  = 66;
+constexpr int CC_TIMBRE     = 71;    // morph toward the next preset
+
+// Not remappable: value = parameter index to learn (see ParamMap.h)
+constexpr int CC_MIDI_LEARN = 119;
+
+// Not remappable: loop transforms (LoopTransform), one per message --
+// send them from a pad or button, not a knob
+constexpr int CC_LOOP_GRID      = 106;  // pull notes to the grid, value = strength
+constexpr int CC_LOOP_HUMANISE  = 107;  // random timing / velocity, value = amount
+constexpr int CC_LOOP_TRANSPOSE = 108;  // 64 = none, +-1 semitone per step
+constexpr int CC_LOOP_VELOCITY  = 109;  // 64 = x1, 127 = ~x2, 0 = all at velocity 1
+                                        // (never 0: that would be a note-off)
+constexpr int CC_LOOP_COMPRESS  = 110;  // value = amount toward kVelocityCentre
+
+// Not remappable: looper commands, triggered by values >= 64
+constexpr int CC_LOOP_SPEED    = 111;  // 64 = 1x, 32 = 1/2x, 96 = 2x (1/4x..4x)
+constexpr int CC_LOOP_REVERSE  = 112;  // >= 64 reverse
+constexpr int CC_CLOCK_MODE    = 113;  // 0-42 internal, 43-85 slave, 86-127 master
+constexpr int CC_LOOP_QUANTISE = 114;  // >= 64 on, < 64 off (see Quantise.h)
+constexpr int CC_LOOP_SAVE  = 115;   // write the loop to kLoopFilePath
+constexpr int CC_LOOP_LOAD  = 116;   // replace the loop with kLoopFilePath
+constexpr int CC_LOOP_UNDO  = 117;
+constexpr int CC_LOOP_REDO  = 118;
+
+// --- High-resolution controllers (MidiHandler) -----------------
+// CC 0..31 carry an MSB whose LSB arrives on CC 32..63.  NRPN
+// parameter (kNrpnParamMsb, ParamId) addresses a ParamMap entry
+// directly with 14-bit data entry.  These CCs cannot be learned.
+constexpr int CC_DATA_ENTRY_MSB = 6;
+constexpr int CC_DATA_ENTRY_LSB = 38;
+constexpr int CC_NRPN_LSB       = 98;
+constexpr int CC_NRPN_MSB       = 99;
+constexpr int CC_RPN_LSB        = 100;
+constexpr int CC_RPN_MSB        = 101;
+constexpr int kNrpnParamMsb     = 1;
 
 // --- Hardware pins ---------------------------------------------
-constexpr int kLoopButtonPin = 0;
+constexpr int kLoopButtonPin  = 0;
+constexpr int kSceneButtonPin = 1;      // short press: next loop scene, long: scene 1
+constexpr int kSdCsPin       = 10;      // Audio Shield SD slot (BUILTIN_SDCARD on a 4.1)
+
+// Control panel: a diode-isolated key matrix, rows driven LOW one
+// at a time, columns read with pull-ups (ButtonMatrix).  Key k is
+// row k / kMatrixCols, column k % kMatrixCols.
+constexpr int kMatrixRows = 3;
+constexpr int kMatrixCols = 4;
+constexpr int kMatrixKeys = kMatrixRows * kMatrixCols;
+constexpr uint8_t kMatrixRowPins[kMatrixRows] = {2, 3, 4};
+constexpr uint8_t kMatrixColPins[kMatrixCols] = {5, 9, 14, 22};
+constexpr uint8_t kPanelPart = 0;       // panel preset / sustain act on channel 1's part
+
+// Knobs: linear pots between 3.3 V and GND on analog pins (A1 is
+// the Audio Shield's volume pot footprint).  See Knobs.h.  Off
+// unless fitted: floating inputs would wander over volume and echo.
+constexpr bool    kKnobsFitted = false;
+constexpr int     kKnobCount = 3;
+constexpr uint8_t kKnobPins[kKnobCount] = {15, 16, 17};   // A1 volume, A2 echo mix, A3 echo fb
+
+// --- Loop files (LoopStore) ------------------------------------
+constexpr const char* kLoopFilePath = "/loop.mid";
+constexpr int kSmfDivision  = 960;      // ticks per quarter note in saved files
+constexpr int kSmfChunkBytes = 128;     // bytes written per slice while saving: a
+                                        // quarter sector, so at most one SD write each
 
 // --- Button timing ---------------------------------------------
-constexpr uint32_t kDebounceMs  = 30;
-constexpr uint32_t kLongPressMs = 3000;
+// Buttons are sampled from a timer interrupt (ButtonScanner), so
+// debounce and press timing do not depend on how fast loop() runs.
+constexpr uint32_t kDebounceMs     = 30;
+constexpr uint32_t kLongPressMs    = 3000;
+constexpr uint32_t kButtonScanUs   = 1000;  // scan period: debounce counts in ms
+constexpr int      kMaxButtons     = 8;     // pins the scanner can watch
+constexpr int      kButtonQueueLen = 16;    // press/release events between drains (power of two)
+
+// Panel gestures (integer ms).  A key with a double-tap binding
+// waits kDoubleTapMs after a tap before it counts as a short press.
+constexpr uint32_t kPanelLongMs  = 600;     // held this long: long press, fired while held
+constexpr uint32_t kDoubleTapMs  = 250;     // second press within this of the first release
+
+// --- Knob sampling ---------------------------------------------
+// One 12-bit conversion per timer tick, knobs in turn; every
+// kAnalogOversample conversions of a knob make one 14-bit sample
+// (one per 12 ms with three knobs).
+constexpr uint32_t kAnalogScanUs     = 250;
+constexpr int      kAnalogOversample = 16;
+constexpr int      kAnalogIirShift   = 2;    // one-pole: 1/4 of the way per sample
+constexpr int      kAnalogHysteresis = 24;   // 14-bit steps a knob must move to send
+
+// --- Main-loop scheduler (Scheduler, Log) ----------------------
+// Task budgets and deadlines are in main.cpp's task table.
+constexpr uint32_t kSchedPassUs    = 1000;   // past this, a pass stops handing out extra slices
+constexpr uint32_t kSchedReportMs  = 10000;  // how often broken limits are logged
+constexpr int      kMidiSliceMsgs  = 16;     // MIDI messages per slice
+constexpr int      kLogBufferBytes = 4096;   // log text waiting for the serial port (power of two)
+constexpr int      kLogSliceBytes  = 256;    // log bytes sent per slice
+
+// --- Instrumentation (Metrics) ---------------------------------
+// Reports go out as SysEx (manufacturer ID 0x7D, for non-commercial
+// use) or as text when '?' arrives on the serial port.
+constexpr int     kMetricsBuckets = 16;     // audio-block load histogram, 1/16 block each
+constexpr uint8_t kSysExMfrId     = 0x7D;
+constexpr uint8_t kSysExMetrics   = 0x4D;   // 'M': metrics messages
+
+// --- EEPROM layout ---------------------------------------------
+constexpr int kEepromCcMapAddr = 0;     // ParamMap: 4-byte header + 128 bytes
 
 // --- Looper sizing ---------------------------------------------
-constexpr int kMaxLoopEvents = 2048;
+// Events live in a delta-encoded byte stream (see LoopTrack.h),
+// typically 3-4 bytes each: ~4-5k events in 16 KB.  Streams grow
+// in 1 KB chunks taken from one shared arena (LoopArena), so a
+// short loop only holds the chunks it fills.
+constexpr int kLoopStreamBytes = 16384;  // longest single stream
+constexpr int kLoopSyncBytes   = 256;    // seek index granularity
+constexpr int kLoopTickShift   = 4;      // event times stored in 16-sample ticks (0.36 ms)
+constexpr int kLoopChunkShift  = 10;     // 1 KB arena chunks
+constexpr int kLoopChunkBytes  = 1 << kLoopChunkShift;
+constexpr int kLoopArenaChunks = 96;     // 96 KB for every stream of every scene
+constexpr int kLoopPoolTracks  = 16;     // layer pool shared by every scene's
+                                         // playing layers, undo history and
+                                         // the overdub being recorded
+
+// --- Loop scenes (Looper::selectScene) ------------------------
+// Independent loops, each with its own layers, length and preset.
+// A switch while playing waits for the loop boundary.
+constexpr int kLoopScenes       = 4;
+constexpr int kLoopSceneChannel = 16;   // Program Change 0..kLoopScenes-1 on this
+                                        // MIDI channel selects a scene; higher
+                                        // programs change that part's preset
+
+// --- Loop quantise (Quantise) ---------------------------------
+// When on, the base take's length snaps to whole beats -- of the
+// MIDI clock if one is running, else of a tempo inferred from the
+// take's note onsets -- and every take's notes snap to a grid
+// chosen for that take.
+constexpr bool  kQuantiseDefault = false;
+constexpr int   kTempoMinBpm     = 60;     // range of inferred tempos
+constexpr int   kTempoMaxBpm     = 200;
+constexpr float kGridFit         = 0.12f;  // max mean distance to a grid, in steps
+                                           // (0.25 = notes played at random)
+
+// --- MIDI clock (MidiClock) -----------------------------------
+// SLAVE follows an incoming clock whenever one runs: its tempo is
+// a least-squares fit over the last kClockFitPulses pulses, and
+// loop cycles start on its beats.  MASTER sends clock to the PC
+// port, on the beat of the loop.
+enum ClockMode : uint8_t { CLOCK_INTERNAL = 0, CLOCK_SLAVE, CLOCK_MASTER };
+constexpr ClockMode kClockModeDefault = CLOCK_SLAVE;
+constexpr int       kClockFitPulses   = 48;      // two beats
+constexpr float     kClockMasterBpm   = 120.0f;  // master tempo until a loop sets one
+
+// --- Loop transforms (LoopTransform) --------------------------
+// Rewrites of the whole loop, swapped in on the loop boundary.
+constexpr float   kHumaniseMaxMs   = 20.0f;  // timing spread at full amount
+constexpr uint8_t kHumaniseMaxVel  = 16;     // velocity spread at full amount
+constexpr int     kTransposeMax    = 24;     // semitones either way
+constexpr float   kVelocityCentre  = 80.0f;  // compression pulls toward this
+
+// --- Looper speed (Looper::setSpeed) --------------------------
+constexpr int     kLoopRateShift   = 16;    // playback rate is Q16.16
+constexpr uint8_t kReverseVelocity = 100;   // reversed notes of a track with no
+                                            // pairing index (stream too full)
+
+// --- Looper scheduling -----------------------------------------
+// true:  loop events are injected by the audio ISR at their exact
+//        sample offsets (immune to main-loop jitter).
+// false: Looper::tick() replays them from loop() (with logging).
+constexpr bool kLooperAudioThread = true;
 
 // --- Helpers ---------------------------------------------------
 
@@ -0,0 +1,35 @@
+// ============================================================
+// AudioClock.cpp -- Sample counter implementation
+//
+// Two words are shared with the ISR: the number of samples
+// rendered so far (= first sample of the next block) and the
+// micros() time of the last update.  now() reads them together
+// with interrupts disabled.
+// ============================================================
+
+#include "AudioClock.h"
+
+static volatile uint32_t sSamples = 0;   // samples rendered so far
+static volatile uint32_t sBlockUs = 0;   // micros() at the last advance()
+
+void AudioClock::advance(uint32_t samples) {
+  sSamples += samples;
+  sBlockUs  = micros();
+}
+
+uint32_t AudioClock::blockStart() {
+  return sSamples;
+}
+
+uint32_t AudioClock::now() {
+  __disable_irq();
+  uint32_t base = sSamples;
+  uint32_t us   = sBlockUs;
+  __enable_irq();
+
+  // Interpolate towards the next block, but never past its end:
+  // the next update() will take over from there.
+  uint32_t off = (uint32_t)((float)(micros() - us) * (AUDIO_SAMPLE_RATE_EXACT / 1000000.0f));
+  if (off > AUDIO_BLOCK_SAMPLES - 1) off = AUDIO_BLOCK_SAMPLES - 1;
+  return base + off;
+}
@@ -1,16 +1,17 @@
 // ============================================================
 // Button.cpp -- Debounced push-button implementation
 //
-// Reads the digital pin every loop() iteration and applies a
-// simple time-based debounce filter.  Once the button is
-// released, the held duration determines whether the short
-// or long press callback is fired.
+// The pin is sampled and debounced by ButtonScanner; this side
+// only turns its press / release events into callbacks.  Both
+// timestamps come from the scan interrupt, so the held duration
+// is exact however late loop() gets to the events.
 //
 // Wiring assumption: button connects pin to GND; the pin is
 // configured as INPUT_PULLUP, so pressed = LOW, released = HIGH.
 // ============================================================
 
 #include "Button.h"
+#include "Log.h"
 
 DebouncedButton::DebouncedButton(int pin, Callback onShort, Callback onLong)
   : pin_(pin)
@@ -26,50 +27,33 @@ void DebouncedButton::begin() {
   Serial.print(pin_);
   Serial.print(" configured, initial state: ");
   Serial.println(digitalRead(pin_) ? "HIGH" : "LOW");
-}
-
-void DebouncedButton::update() {
-  bool raw = digitalRead(pin_);
-  uint32_t now = millis();
 
-  // ---- Debounce: restart the timer on every raw transition ----
-  if (raw != lastRawRead_) {
-    lastRawRead_  = raw;
-    lastChangeMs_ = now;
-    Serial.print("[BTN] Pin change: ");
-    Serial.println(raw ? "HIGH" : "LOW");
+  if (ButtonScanner::add(pin_, this) < 0) {
+    Serial.println("[BTN] Scanner full -- button ignored");
   }
+}
 
-  // Ignore changes that haven't been stable long enough
-  if ((now - lastChangeMs_) < kDebounceMs) return;
-
-  // ---- Stable transition detected -----------------------------
-  if (raw != stableState_) {
-    stableState_ = raw;
-
-    Serial.print("[BTN] Stable: ");
-    Serial.println(stableState_ ? "HIGH (released)" : "LOW (pressed)");
+void DebouncedButton::onEvent(bool pressed, uint32_t ms) {
+  if (pressed == pressed_) return;
+  pressed_ = pressed;
 
-    if (stableState_ == false) {
-      // Button just pressed -- record the timestamp
-      Serial.println("[BTN] >>> BUTTON PRESSED <<<");
-      pressStartMs_ = now;
+  if (pressed) {
+    Log.println("[BTN] >>> BUTTON PRESSED <<<");
+    pressStartMs_ = ms;
+    return;
+  }
 
-    } else {
-      // Button just released -- measure how long it was held
-      uint32_t held = now - pressStartMs_;
+  uint32_t held = ms - pressStartMs_;
 
-      Serial.print("[BTN] >>> BUTTON RELEASED after ");
-      Serial.print(held);
-      Serial.println(" ms");
+  Log.print("[BTN] >>> BUTTON RELEASED after ");
+  Log.print(held);
+  Log.println(" ms");
 
-      if (held >= kLongPressMs) {
-        Serial.println("[BTN] -> LONG PRESS");
-        if (onLong_) onLong_();
-      } else {
-        Serial.println("[BTN] -> SHORT PRESS");
-        if (onShort_) onShort_();
-      }
-    }
+  if (held >= kLongPressMs) {
+    Log.println("[BTN] -> LONG PRESS");
+    if (onLong_) onLong_();
+  } else {
+    Log.println("[BTN] -> SHORT PRESS");
+    if (onShort_) onShort_();
   }
 }
@@ -0,0 +1,85 @@
+// ============================================================
+// ButtonMatrix.cpp -- Row-per-tick scan, vertical counters
+//
+// Rows are outputs: the selected one LOW, the others HIGH (the
+// diodes keep two held keys from shorting rows).  A row is
+// selected at the end of one tick and read at the start of the
+// next, which leaves a whole scan period for the lines to settle.
+//
+// Vertical counter, per column bit: (cnt1, cnt0) sits at 11 while
+// the raw level agrees with the accepted one and counts down
+// 10, 01, 00 while it disagrees; the fourth disagreeing sample
+// rolls it back to 11 and flips the accepted level.
+// ============================================================
+
+#include "ButtonMatrix.h"
+#include "SpscQueue.h"
+
+static_assert(kMatrixCols <= 8, "a row's columns are one byte");
+
+static uint8_t sState[kMatrixRows];        // accepted, bit c = column c pressed
+static uint8_t sCnt0[kMatrixRows];
+static uint8_t sCnt1[kMatrixRows];
+static uint8_t sRow = 0;                   // row selected by the last tick
+
+static SpscQueue<ButtonMatrix::Event, kButtonQueueLen> sQueue;
+static IntervalTimer sTimer;
+
+static void selectRow(uint8_t row) {
+  digitalWriteFast(kMatrixRowPins[sRow], HIGH);
+  digitalWriteFast(kMatrixRowPins[row], LOW);
+  sRow = row;
+}
+
+static void scanIsr() {
+  uint8_t r   = sRow;
+  uint8_t raw = 0;
+  for (int c = 0; c < kMatrixCols; c++) {
+    raw |= (uint8_t)(!digitalReadFast(kMatrixColPins[c])) << c;   // pressed = LOW
+  }
+
+  uint8_t delta = raw ^ sState[r];
+  sCnt0[r] = ~(sCnt0[r] & delta);
+  sCnt1[r] = sCnt0[r] ^ (sCnt1[r] & delta);
+  uint8_t flip = delta & sCnt0[r] & sCnt1[r];
+  sState[r] ^= flip;
+
+  if (flip) {
+    uint32_t now = millis();
+    while (flip) {
+      int c = __builtin_ctz(flip);
+      flip &= flip - 1;
+      sQueue.push({(uint8_t)(r * kMatrixCols + c), (bool)((sState[r] >> c) & 1), now});
+    }
+  }
+
+  selectRow(r + 1 < kMatrixRows ? r + 1 : 0);
+}
+
+void ButtonMatrix::begin() {
+  for (int c = 0; c < kMatrixCols; c++) pinMode(kMatrixColPins[c], INPUT_PULLUP);
+  for (int r = 0; r < kMatrixRows; r++) {
+    pinMode(kMatrixRowPins[r], OUTPUT);
+    digitalWriteFast(kMatrixRowPins[r], HIGH);
+    sCnt0[r] = 0xFF;                       // counters idle
+    sCnt1[r] = 0xFF;
+  }
+  selectRow(0);
+  sTimer.begin(scanIsr, kButtonScanUs);
+
+  Serial.print("[PANEL] Matrix ");
+  Serial.print(kMatrixRows);
+  Serial.print("x");
+  Serial.print(kMatrixCols);
+  Serial.print(", one row every ");
+  Serial.print(kButtonScanUs);
+  Serial.println(" us");
+}
+
+bool ButtonMatrix::pop(Event& ev) {
+  return sQueue.pop(ev);
+}
+
+uint32_t ButtonMatrix::dropped() {
+  return sQueue.dropped();
+}
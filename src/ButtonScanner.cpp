@@ -0,0 +1,76 @@
+// ============================================================
+// ButtonScanner.cpp -- Scan ISR, debounce and event queue
+//
+// The scan ISR is the queue's only producer and poll() its only
+// consumer (see SpscQueue.h), so neither side masks interrupts.
+// Each pin's debounce state is touched only by the ISR once
+// begin() has started the timer.
+// ============================================================
+
+#include "ButtonScanner.h"
+#include "Button.h"
+#include "SpscQueue.h"
+
+static constexpr uint8_t kDebounceScans =
+    (uint8_t)((kDebounceMs * 1000 + kButtonScanUs - 1) / kButtonScanUs);
+
+/// Debounce state of one pin.
+struct Scan {
+  uint8_t pin;
+  bool    pressed;    // accepted level
+  uint8_t count;      // scans the raw level has disagreed with it
+};
+
+static Scan             sScan[kMaxButtons];
+static DebouncedButton* sButtons[kMaxButtons];
+static int              sCount = 0;
+
+static SpscQueue<ButtonScanner::Event, kButtonQueueLen> sQueue;
+static IntervalTimer sTimer;
+
+static void scanIsr() {
+  uint32_t now = millis();
+  for (int i = 0; i < sCount; i++) {
+    Scan& s = sScan[i];
+    bool pressed = !digitalReadFast(s.pin);   // INPUT_PULLUP: pressed = LOW
+    if (pressed == s.pressed) {
+      s.count = 0;
+    } else if (++s.count >= kDebounceScans) {
+      s.pressed = pressed;
+      s.count   = 0;
+      sQueue.push({(uint8_t)i, pressed, now});
+    }
+  }
+}
+
+int ButtonScanner::add(int pin, DebouncedButton* button) {
+  if (sCount >= kMaxButtons) return -1;
+  Scan& s = sScan[sCount];
+  s.pin     = (uint8_t)pin;
+  s.pressed = !digitalRead(pin);   // held at boot: no press until released
+  s.count   = 0;
+  sButtons[sCount] = button;
+  return sCount++;
+}
+
+void ButtonScanner::begin() {
+  sTimer.begin(scanIsr, kButtonScanUs);
+  Serial.print("[BTN] Scanning ");
+  Serial.print(sCount);
+  Serial.print(" button(s) every ");
+  Serial.print(kButtonScanUs);
+  Serial.println(" us");
+}
+
+bool ButtonScanner::pop(Event& ev) {
+  return sQueue.pop(ev);
+}
+
+void ButtonScanner::poll() {
+  Event ev;
+  while (pop(ev)) sButtons[ev.button]->onEvent(ev.pressed, ev.ms);
+}
+
+uint32_t ButtonScanner::dropped() {
+  return sQueue.dropped();
+}
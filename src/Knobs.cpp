@@ -0,0 +1,113 @@
+// ============================================================
+// Knobs.cpp -- Round-robin ADC sampling, IIR and hysteresis
+//
+// The ISR owns the accumulators; each finished sample is
+// published as a 16-bit value plus a sequence number, both
+// single stores, so poll() needs no interrupt masking.
+//
+// analogRead() waits for its conversion (a few us at 12 bits
+// without hardware averaging), so a tick does exactly one.
+// ============================================================
+
+#include "Knobs.h"
+#include "MidiHandler.h"
+#include "ParamMap.h"
+
+static constexpr uint32_t kFullScale = 16383;        // 14-bit output
+static constexpr uint32_t kAdcMax    = 4095;         // 12-bit conversions
+static constexpr int      kIirFrac   = 4;            // filter state: 14.4 fixed point
+
+static_assert((uint64_t)kAdcMax * kAnalogOversample * kFullScale <= 0xFFFFFFFFu,
+              "oversampled sum must scale in 32 bits");
+
+/// Parameter each knob drives (same order as kKnobPins).
+static const uint8_t kKnobParams[kKnobCount] = {
+  PARAM_MASTER_VOL, PARAM_ECHO_MIX, PARAM_ECHO_FB
+};
+
+// --- ISR side --------------------------------------------------
+
+static uint32_t          sAcc[kKnobCount];
+static uint8_t           sTaken[kKnobCount];
+static uint8_t           sKnob = 0;
+static volatile uint16_t sRaw[kKnobCount];   // last 14-bit sample
+static volatile uint8_t  sSeq[kKnobCount];   // bumped after each sample
+
+static IntervalTimer sTimer;
+
+static void sampleIsr() {
+  uint8_t k = sKnob;
+  sAcc[k] += analogRead(kKnobPins[k]);
+  if (++sTaken[k] == kAnalogOversample) {
+    sRaw[k]   = (uint16_t)(sAcc[k] * kFullScale / (kAdcMax * kAnalogOversample));
+    sSeq[k]   = sSeq[k] + 1;
+    sAcc[k]   = 0;
+    sTaken[k] = 0;
+  }
+  sKnob = k + 1 < kKnobCount ? k + 1 : 0;
+}
+
+// --- Main-thread side ------------------------------------------
+
+struct KnobState {
+  uint8_t  seen   = 0;       // last sSeq handled
+  bool     primed = false;   // filter holds a real position
+  int32_t  filt   = 0;       // IIR state, 14.4 fixed point
+  uint16_t sent   = 0;       // last value passed on
+};
+
+static KnobState sKnobs[kKnobCount];
+
+/// Snap the last kAnalogHysteresis steps at either end onto the
+/// end itself, so the deadband never keeps a knob off 0 or full.
+static uint16_t snapEnds(int32_t v) {
+  if (v <= kAnalogHysteresis) return 0;
+  if (v >= (int32_t)kFullScale - kAnalogHysteresis) return kFullScale;
+  return (uint16_t)v;
+}
+
+static void send(int k, uint16_t v) {
+  sKnobs[k].sent = v;
+  MidiHandler::applyParam(kPanelPart, kKnobParams[k], (float)v / kFullScale);
+}
+
+void Knobs::begin() {
+  if (!kKnobsFitted) return;
+  analogReadResolution(12);
+  analogReadAveraging(1);          // oversampled in software instead
+  sTimer.begin(sampleIsr, kAnalogScanUs);
+
+  Serial.print("[KNOB] ");
+  Serial.print(kKnobCount);
+  Serial.println(" knob(s) sampling");
+}
+
+void Knobs::poll() {
+  if (!kKnobsFitted) return;
+  for (int k = 0; k < kKnobCount; k++) {
+    KnobState& s   = sKnobs[k];
+    uint8_t    seq = sSeq[k];
+    if (seq == s.seen) continue;
+    s.seen = seq;
+
+    int32_t raw = sRaw[k];
+    if (!s.primed) {
+      s.primed = true;
+      s.filt   = raw << kIirFrac;
+      send(k, snapEnds(raw));
+      continue;
+    }
+
+    s.filt += ((raw << kIirFrac) - s.filt) >> kAnalogIirShift;
+    uint16_t v = snapEnds(s.filt >> kIirFrac);
+    int32_t  d = (int32_t)v - s.sent;
+    if (d == 0) continue;
+    if (d > kAnalogHysteresis || d < -kAnalogHysteresis || v == 0 || v == kFullScale) {
+      send(k, v);
+    }
+  }
+}
+
+uint16_t Knobs::value(int k) {
+  return snapEnds(sKnobs[k].filt >> kIirFrac);
+}
@@ -0,0 +1,48 @@
+// ============================================================
+// Log.cpp -- Buffered serial log implementation
+//
+// head_ and tail_ count bytes ever written and sent; the ring
+// index is the count masked to its size.  drain() writes the
+// contiguous run up to the end of the ring, so one slice is at
+// most two Serial.write() calls over successive drains.
+// ============================================================
+
+#include "Log.h"
+
+static_assert((kLogBufferBytes & (kLogBufferBytes - 1)) == 0,
+              "kLogBufferBytes must be a power of two");
+
+LogBuffer Log;
+
+size_t LogBuffer::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t LogBuffer::write(const uint8_t* data, size_t size) {
+  size_t room = kLogBufferBytes - (head_ - tail_);
+  if (size > room) {
+    dropped_ += size - room;
+    size = room;
+  }
+  for (size_t i = 0; i < size; i++) {
+    ring_[(head_ + i) & (kLogBufferBytes - 1)] = data[i];
+  }
+  head_ += size;
+  return size;
+}
+
+bool LogBuffer::drain(int maxBytes) {
+  int n = pending();
+  if (n > maxBytes) n = maxBytes;
+  int room = Serial.availableForWrite();
+  if (n > room) n = room;
+
+  uint32_t at  = tail_ & (kLogBufferBytes - 1);
+  uint32_t run = kLogBufferBytes - at;           // up to the end of the ring
+  if ((uint32_t)n > run) n = (int)run;
+  if (n > 0) {
+    Serial.write(ring_ + at, n);
+    tail_ += n;
+  }
+  return pending() > 0;
+}
@@ -0,0 +1,44 @@
+// ============================================================
+// LoopArena.cpp -- Chunk arena with a free bitmap
+//
+// One bit per chunk, set while the chunk is in use.  The bitmap
+// starts out zeroed like any static, so the arena needs no
+// begin() and is ready before the LoopTrack constructors run.
+// ============================================================
+
+#include "LoopArena.h"
+
+static constexpr int kWords = (kLoopArenaChunks + 31) / 32;
+
+static uint8_t  sChunks[kLoopArenaChunks][kLoopChunkBytes];
+static uint32_t sUsed[kWords];
+static int      sFree = kLoopArenaChunks;
+
+uint8_t LoopArena::alloc() {
+  for (int w = 0; w < kWords; w++) {
+    uint32_t freeBits = ~sUsed[w];
+    if (!freeBits) continue;
+    int id = w * 32 + __builtin_ctz(freeBits);
+    if (id >= kLoopArenaChunks) break;
+    sUsed[w] |= 1u << (id & 31);
+    sFree--;
+    return (uint8_t)id;
+  }
+  return kNone;
+}
+
+void LoopArena::release(uint8_t id) {
+  if (id >= kLoopArenaChunks) return;
+  uint32_t bit = 1u << (id & 31);
+  if (!(sUsed[id / 32] & bit)) return;
+  sUsed[id / 32] &= ~bit;
+  sFree++;
+}
+
+uint8_t* LoopArena::chunk(uint8_t id) {
+  return sChunks[id];
+}
+
+int LoopArena::freeChunks() {
+  return sFree;
+}
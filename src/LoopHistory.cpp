@@ -0,0 +1,115 @@
+// ============================================================
+// LoopHistory.cpp -- Layer pool, history chains and undo/redo
+//
+// Reference owners: each chain's head (1), each child (1 on its
+// parent), each redo entry (1), the recorder between alloc() and
+// push()/discard() (1), and any retain() from outside.
+// release() cascades down the parent chain when a count drops
+// to zero, clearing each freed track so its chunks go straight
+// back to the arena.
+// ============================================================
+
+#include "LoopHistory.h"
+
+LoopHistory::LoopHistory() {
+  for (int s = 0; s < kLoopScenes; s++) clear(s);
+}
+
+void LoopHistory::retain(uint8_t slot) {
+  if (slot != kNone) nodes_[slot].refs++;
+}
+
+void LoopHistory::release(uint8_t slot) {
+  while (slot != kNone && --nodes_[slot].refs == 0) {
+    uint8_t parent = nodes_[slot].parent;
+    nodes_[slot].parent = kNone;
+    nodes_[slot].track.clear();
+    slot = parent;               // the child's reference goes too
+  }
+}
+
+void LoopHistory::dropRedo(Chain& c) {
+  while (c.redoCount > 0) release(c.redo[--c.redoCount]);
+}
+
+void LoopHistory::clear(int scene) {
+  Chain& c = chains_[scene];
+  dropRedo(c);
+  release(c.head);
+  c.head = kNone;
+}
+
+uint8_t LoopHistory::alloc() {
+  for (int pass = 0; pass < 2; pass++) {
+    for (uint8_t i = 0; i < kLoopPoolTracks; i++) {
+      if (nodes_[i].refs == 0) {
+        nodes_[i].refs   = 1;    // held by the recorder
+        nodes_[i].parent = kNone;
+        nodes_[i].track.clear();
+        return i;
+      }
+    }
+    bool any = false;
+    for (Chain& c : chains_) {
+      any |= c.redoCount > 0;
+      dropRedo(c);               // pool full: give up redo, retry
+    }
+    if (!any) break;
+  }
+  return kNone;
+}
+
+void LoopHistory::discard(uint8_t slot) {
+  release(slot);
+}
+
+void LoopHistory::push(int scene, uint8_t slot) {
+  Chain& c = chains_[scene];
+  dropRedo(c);
+  nodes_[slot].track.buildPairs();   // immutable from here on
+  nodes_[slot].parent = c.head;  // head's reference passes to the child
+  c.head = slot;                 // recorder's reference passes to head
+}
+
+void LoopHistory::replaceHead(int scene, uint8_t slot) {
+  Chain&  c   = chains_[scene];
+  uint8_t old = c.head;
+  dropRedo(c);
+  nodes_[slot].track.buildPairs();
+  nodes_[slot].parent = nodes_[old].parent;
+  retain(nodes_[slot].parent);   // the copy is a second child
+  c.head = slot;                 // recorder's reference passes to head
+  release(old);                  // ...and head's old one goes
+}
+
+void LoopHistory::replaceAll(int scene, const uint8_t* slots, int count) {
+  clear(scene);
+  for (int i = 0; i < count; i++) push(scene, slots[i]);
+}
+
+bool LoopHistory::undo(int scene) {
+  Chain& c = chains_[scene];
+  if (c.head == kNone || nodes_[c.head].parent == kNone) return false;
+  c.redo[c.redoCount++] = c.head;   // head's reference passes to redo
+  c.head = nodes_[c.head].parent;
+  retain(c.head);
+  return true;
+}
+
+bool LoopHistory::redo(int scene) {
+  Chain& c = chains_[scene];
+  if (c.redoCount == 0) return false;
+  uint8_t slot = c.redo[--c.redoCount];
+  release(c.head);               // still referenced by `slot`
+  c.head = slot;                 // redo's reference passes to head
+  return true;
+}
+
+int LoopHistory::layers(int scene, uint8_t* out) const {
+  uint8_t head = chains_[scene].head;
+  int n = 0;
+  for (uint8_t s = head; s != kNone; s = nodes_[s].parent) n++;
+  int i = n;
+  for (uint8_t s = head; s != kNone; s = nodes_[s].parent) out[--i] = s;
+  return n;
+}
@@ -0,0 +1,262 @@
+// ============================================================
+// LoopStore.cpp -- SMF persistence for the looper
+//
+// Glue between Looper, SmfCodec and the SD card.  A save works on
+// a pinned Looper::Snapshot, so playback, overdubs and undo can
+// carry on while the file is written.
+// ============================================================
+
+#include "LoopStore.h"
+#include "Looper.h"
+#include "ParamMap.h"
+#include "SmfCodec.h"
+#include "config.h"
+#include "Log.h"
+#include <Arduino.h>
+#include <Audio.h>
+#include <SD.h>
+
+static Looper* sLoop = nullptr;
+static FS*     sFs   = nullptr;     // SD card; LittleFS would plug in the same way
+
+// Save in progress
+static bool             sSaving     = false;
+static File             sFile;
+static SmfWriter        sWriter;
+static Looper::Snapshot sSnap;
+static bool             sPresetSent = false;
+static bool             sLsbPending = false;   // sLsb goes out next
+static SmfEvent         sLsb;
+static bool             sFlushed    = false;   // data on the card, header not patched yet
+
+/// One file tick = one LoopTrack tick (2^kLoopTickShift samples):
+/// the tempo is whatever makes kSmfDivision ticks last that long.
+static SmfTiming timing() {
+  SmfTiming t;
+  t.sampleRate   = AUDIO_SAMPLE_RATE_EXACT;
+  t.division     = kSmfDivision;
+  t.usPerQuarter = (uint32_t)lround(1e6 * kSmfDivision * (1 << kLoopTickShift)
+                                    / AUDIO_SAMPLE_RATE_EXACT);
+  return t;
+}
+
+// --- Saving ----------------------------------------------------
+
+/// SmfWriter source: the frozen preset, then the merged layers.
+static bool nextEvent(void*, SmfEvent& ev) {
+  if (!sPresetSent) {
+    sPresetSent = true;
+    ev = { 0, 0xC0, sSnap.preset, 0 };
+    return true;
+  }
+  if (sLsbPending) {
+    sLsbPending = false;
+    ev = sLsb;
+    return true;
+  }
+
+  const LoopEvent* e = sSnap.merge.peek();
+  if (!e) return false;
+
+  ev.time  = e->time;
+  ev.data1 = e->note;
+  ev.data2 = e->velocity;
+  switch (e->type) {
+    case EVT_NOTE_ON:  ev.status = 0x90; break;
+    case EVT_NOTE_OFF: ev.status = 0x80; ev.data2 = 0; break;
+    case EVT_PROGRAM:  ev.status = 0xC0; break;
+    case EVT_BEND:     ev.status = 0xE0; break;    // LSB, MSB as stored
+    case EVT_PRESSURE: ev.status = 0xD0; break;
+    default:
+      ev.status = 0xB0;
+      ev.data1  = ParamMap::desc(e->note).defaultCc;
+      if (ev.data1 < 32) {               // 14-bit pair: LSB on the CC 32 above
+        sLsb        = { ev.time, 0xB0, (uint8_t)(ev.data1 + 32), e->fine };
+        sLsbPending = true;
+      }
+      break;
+  }
+  sSnap.merge.advance();
+  return true;
+}
+
+bool LoopStore::save() {
+  if (sSaving) {
+    Log.println("[STORE] Save already running");
+    return false;
+  }
+  if (!sFs) {
+    Log.println("[STORE] No SD card");
+    return false;
+  }
+  if (!sLoop->openSnapshot(sSnap)) {
+    Log.println("[STORE] Nothing to save");
+    return false;
+  }
+
+  sFs->remove(kLoopFilePath);
+  sFile = sFs->open(kLoopFilePath, FILE_WRITE);
+  if (!sFile) {
+    Log.println("[STORE] Cannot create file");
+    sLoop->closeSnapshot(sSnap);
+    return false;
+  }
+
+  sPresetSent = false;
+  sLsbPending = false;
+  sFlushed    = false;
+  sWriter.begin(timing(), sSnap.length, nextEvent, nullptr);
+  sSaving = true;
+
+  Log.print("[STORE] Saving ");
+  Log.print(sSnap.count);
+  Log.print(" layer(s) to ");
+  Log.println(kLoopFilePath);
+  return true;
+}
+
+void LoopStore::poll() {
+  if (!sSaving) return;
+
+  uint8_t buf[kSmfChunkBytes];
+  size_t n = sWriter.read(buf, sizeof(buf));
+  if (n > 0) {
+    sFile.write(buf, n);
+    return;
+  }
+
+  // Done: flush the last sector, then (next slice) patch the track
+  // length into the header, so neither slice waits on two writes
+  if (!sFlushed) {
+    sFile.flush();
+    sFlushed = true;
+    return;
+  }
+  uint8_t len[4];
+  sWriter.trackLengthBytes(len);
+  sFile.seek(SmfWriter::kTrackLengthOffset);
+  sFile.write(len, 4);
+  sFile.close();
+
+  sLoop->closeSnapshot(sSnap);
+  sSaving = false;
+  Log.println("[STORE] Save complete");
+}
+
+bool LoopStore::busy() {
+  return sSaving;
+}
+
+// --- Loading ---------------------------------------------------
+
+static int readByte(void* ctx) {
+  return static_cast<File*>(ctx)->read();
+}
+
+bool LoopStore::load() {
+  if (sSaving) {
+    Log.println("[STORE] Busy saving");
+    return false;
+  }
+  if (!sFs) {
+    Log.println("[STORE] No SD card");
+    return false;
+  }
+
+  File f = sFs->open(kLoopFilePath, FILE_READ);
+  if (!f) {
+    Log.println("[STORE] No loop file");
+    return false;
+  }
+
+  SmfReader reader;
+  if (!reader.begin(readByte, &f, AUDIO_SAMPLE_RATE_EXACT)) {
+    Log.println("[STORE] Not a type 0 MIDI file");
+    f.close();
+    return false;
+  }
+
+  if (!sLoop->beginImport()) {
+    Log.println("[STORE] No free loop layer");
+    f.close();
+    return false;
+  }
+
+  SmfEvent ev;
+  int     count  = 0;
+  bool    frozen = false;
+  uint8_t msb[PARAM_COUNT] = {};       // last MSB per param, for its LSB
+  while (reader.next(ev)) {
+    uint8_t kind = ev.status & 0xF0;
+    LoopEvent le = { ev.time, 0, ev.data1, ev.data2, 0 };
+
+    if (kind == 0x90 && ev.data2 > 0) {
+      le.type = EVT_NOTE_ON;
+    } else if (kind == 0x80 || kind == 0x90) {
+      le.type = EVT_NOTE_OFF;
+      le.velocity = 0;
+    } else if (kind == 0xB0) {
+      uint8_t id  = ParamMap::paramForDefaultCc(ev.data1);
+      bool    lsb = false;
+      if (id == PARAM_NONE && ev.data1 >= 32 && ev.data1 < 64) {
+        id  = ParamMap::paramForDefaultCc(ev.data1 - 32);
+        lsb = true;
+      }
+      if (id == PARAM_NONE || !(ParamMap::desc(id).targets & TARGET_RECORD)) continue;
+      le.type = EVT_PARAM;
+      le.note = id;
+      if (lsb) {
+        le.velocity = msb[id];
+        le.fine     = ev.data2;
+      } else {
+        msb[id] = ev.data2;
+        le.fine = ev.data2;              // 7 bits widened: 127 is full scale
+      }
+    } else if (kind == 0xC0) {
+      le.note = ev.data1 % 4;              // same wrap as MidiHandler
+      if (ev.time == 0 && !frozen) {       // start-of-loop preset
+        sLoop->importPreset(le.note);
+        frozen = true;
+        continue;
+      }
+      le.type = EVT_PROGRAM;
+    } else if (kind == 0xE0) {
+      le.type = EVT_BEND;
+    } else if (kind == 0xD0) {
+      le.type = EVT_PRESSURE;
+    } else {
+      continue;
+    }
+
+    if (!sLoop->importEvent(le)) {
+      Log.println("[STORE] Loop full, rest of file ignored");
+      break;
+    }
+    count++;
+  }
+  f.close();
+
+  if (reader.error()) Log.println("[STORE] File truncated or corrupt");
+
+  if (!sLoop->endImport(reader.endTime())) {
+    Log.println("[STORE] File has no notes");
+    return false;
+  }
+
+  Log.print("[STORE] Loaded ");
+  Log.print(count);
+  Log.println(" events");
+  return true;
+}
+
+// --- Setup -----------------------------------------------------
+
+void LoopStore::begin(Looper& looper) {
+  sLoop = &looper;
+  if (SD.begin(kSdCsPin)) {
+    sFs = &SD;
+    Serial.println("[STORE] SD card ready");
+  } else {
+    Serial.println("[STORE] No SD card: save/load disabled");
+  }
+}
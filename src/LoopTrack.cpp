@@ -0,0 +1,239 @@
+// ============================================================
+// LoopTrack.cpp -- Delta/VLQ event stream with a sync index
+//
+// The writer keeps the quantised time of the last event and the
+// running status; the reader mirrors both in a LoopCursor.  The
+// first event after each sync point always carries its status
+// byte, so decoding can start at any sync point.  Byte offsets are
+// split into a chunk number and an offset inside the chunk; the
+// chunk size is a power of two, so that is a shift and a mask.
+//
+// LoopMerge keeps one cursor per track in a binary min-heap.
+// ============================================================
+
+#include "LoopTrack.h"
+
+static constexpr uint8_t kStatusNote = 0x80 | EVT_NOTE_ON;
+
+/// Data bytes following the status (or delta, with running status).
+static inline int dataBytes(uint8_t type) {
+  if (type == EVT_PARAM) return 3;
+  return (type == EVT_PROGRAM || type == EVT_PRESSURE) ? 1 : 2;
+}
+
+// --- Writing ---------------------------------------------------
+
+LoopTrack::LoopTrack() {
+  clear();
+}
+
+void LoopTrack::clear() {
+  while (chunkCount_ > 0) LoopArena::release(chunks_[--chunkCount_]);
+  bytes_     = 0;
+  count_     = 0;
+  lastTicks_ = 0;
+  status_    = 0;
+  paired_    = false;
+  crossOut_.clear();
+  crossIn_.clear();
+  syncs_[0]  = { 0, 0, 0 };
+  syncCount_ = 1;
+}
+
+bool LoopTrack::reserve(uint32_t end) {
+  if (end > kLoopStreamBytes) return false;
+  while ((uint32_t)chunkCount_ << kLoopChunkShift < end) {
+    uint8_t id = LoopArena::alloc();
+    if (id == LoopArena::kNone) return false;
+    chunks_[chunkCount_++] = id;
+  }
+  return true;
+}
+
+bool LoopTrack::append(const LoopEvent& ev) {
+  uint32_t ticks = ev.time >> kLoopTickShift;
+  uint32_t delta = (ticks > lastTicks_) ? ticks - lastTicks_ : 0;
+
+  // Open a new sync point once the current one is far enough back
+  bool sync = bytes_ - syncs_[syncCount_ - 1].offset >= kLoopSyncBytes
+           && syncCount_ < kMaxSyncPoints;
+
+  bool    note   = ev.type == EVT_NOTE_ON || ev.type == EVT_NOTE_OFF;
+  uint8_t status = note ? kStatusNote : (0x80 | ev.type);
+  uint8_t data2  = (ev.type == EVT_NOTE_OFF) ? 0 : (ev.velocity & 0x7F);
+  int     data   = note ? 2 : dataBytes(ev.type);
+  bool needStatus = sync || status != status_;
+
+  // Big-endian VLQ, at most 5 bytes for 32 bits
+  uint8_t  vlq[5];
+  int      n = 0;
+  uint32_t d = delta;
+  do {
+    vlq[n++] = d & 0x7F;
+    d >>= 7;
+  } while (d);
+
+  if (!reserve(bytes_ + n + (needStatus ? 1 : 0) + data)) return false;
+
+  if (sync) syncs_[syncCount_++] = { lastTicks_, bytes_, (uint16_t)count_ };
+
+  while (n > 1) *at(bytes_++) = vlq[--n] | 0x80;
+  *at(bytes_++) = vlq[0];
+  if (needStatus) *at(bytes_++) = status;
+  *at(bytes_++) = ev.note & 0x7F;
+  if (data >= 2) *at(bytes_++) = data2;
+  if (data == 3) *at(bytes_++) = ev.fine & 0x7F;
+
+  status_    = status;
+  lastTicks_ += delta;
+  paired_     = false;           // the index was where the stream grows
+  count_++;
+  return true;
+}
+
+// --- Reading ---------------------------------------------------
+
+/// Decode the event at c.pos into c.next (or mark the cursor done).
+void LoopTrack::advance(LoopCursor& c) const {
+  if (c.valid) c.index++;
+  if (c.pos >= bytes_) {
+    c.valid = false;
+    return;
+  }
+
+  uint32_t delta = 0;
+  uint8_t  b;
+  do {
+    b = *at(c.pos++);
+    delta = (delta << 7) | (b & 0x7F);
+  } while (b & 0x80);
+
+  if (*at(c.pos) & 0x80) c.status = *at(c.pos++);
+  uint8_t type = c.status & 0x7F;
+  uint8_t d1   = *at(c.pos++);
+  int     data = (c.status == kStatusNote) ? 2 : dataBytes(type);
+  uint8_t d2   = (data >= 2) ? *at(c.pos++) : 0;
+  uint8_t d3   = (data == 3) ? *at(c.pos++) : 0;
+
+  c.ticks += delta;
+  c.next.time = c.ticks << kLoopTickShift;
+  c.next.note = d1;
+  c.next.velocity = d2;
+  c.next.fine = d3;
+  if (c.status == kStatusNote) c.next.type = d2 ? EVT_NOTE_ON : EVT_NOTE_OFF;
+  else                         c.next.type = type;
+  c.valid = true;
+}
+
+void LoopTrack::startAt(LoopCursor& c, const SyncPoint& s) const {
+  c.valid  = false;
+  c.pos    = s.offset;
+  c.index  = s.index;
+  c.status = 0;
+  c.ticks  = s.ticks;
+  advance(c);
+}
+
+void LoopTrack::rewind(LoopCursor& c) const {
+  static const SyncPoint kStart = { 0, 0, 0 };
+  startAt(c, kStart);
+}
+
+void LoopTrack::seek(LoopCursor& c, uint32_t time) const {
+  uint32_t ticks = (time + (1u << kLoopTickShift) - 1) >> kLoopTickShift;
+
+  // Last sync point whose preceding events are all before `time`
+  int lo = 0, hi = syncCount_ - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (syncs_[mid].ticks < ticks) lo = mid;
+    else                           hi = mid - 1;
+  }
+
+  startAt(c, syncs_[lo]);
+  while (c.valid && c.next.time < time) advance(c);
+}
+
+// --- Note pairing ----------------------------------------------
+
+bool LoopTrack::buildPairs() {
+  bool room = reserve(bytes_ + count_);
+
+  uint8_t on[128] = {};          // velocity of each sounding note
+  crossOut_.clear();
+  crossIn_.clear();
+  LoopCursor c;
+  for (rewind(c); c.valid; advance(c)) {
+    const LoopEvent& e = c.next;
+    uint8_t v = 0;
+    if (e.type == EVT_NOTE_ON) {
+      on[e.note] = e.velocity;
+      crossOut_.set(e.note);
+    } else if (e.type == EVT_NOTE_OFF) {
+      v = on[e.note];
+      on[e.note] = 0;
+      crossOut_.reset(e.note);
+      if (!v) crossIn_.set(e.note);
+    }
+    if (room) *at(bytes_ + c.index) = v;
+  }
+  paired_ = room;
+  return room;
+}
+
+uint8_t LoopTrack::pairedVelocity(int index) const {
+  if (!paired_) return kReverseVelocity;
+  return *at(bytes_ + index);
+}
+
+// --- LoopMerge -------------------------------------------------
+
+bool LoopMerge::less(uint8_t a, uint8_t b) const {
+  uint32_t ta = cursors_[a].next.time, tb = cursors_[b].next.time;
+  return ta < tb || (ta == tb && a < b);
+}
+
+void LoopMerge::clear() {
+  count_    = 0;
+  heapSize_ = 0;
+}
+
+void LoopMerge::add(const LoopTrack& track, uint32_t from) {
+  if (count_ >= kLoopPoolTracks) return;
+  uint8_t k = count_++;
+  tracks_[k] = &track;
+  if (from) track.seek(cursors_[k], from);
+  else      track.rewind(cursors_[k]);
+  if (!cursors_[k].valid) return;
+
+  // Sift up
+  int i = heapSize_++;
+  heap_[i] = k;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!less(heap_[i], heap_[parent])) break;
+    uint8_t tmp = heap_[i]; heap_[i] = heap_[parent]; heap_[parent] = tmp;
+    i = parent;
+  }
+}
+
+const LoopEvent* LoopMerge::peek() const {
+  return heapSize_ ? &cursors_[heap_[0]].next : nullptr;
+}
+
+void LoopMerge::advance() {
+  uint8_t top = heap_[0];
+  tracks_[top]->advance(cursors_[top]);
+  if (!cursors_[top].valid) heap_[0] = heap_[--heapSize_];
+
+  // Sift the (possibly later) top down
+  int i = 0;
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if (l < heapSize_ && less(heap_[l], heap_[m])) m = l;
+    if (r < heapSize_ && less(heap_[r], heap_[m])) m = r;
+    if (m == i) break;
+    uint8_t tmp = heap_[i]; heap_[i] = heap_[m]; heap_[m] = tmp;
+    i = m;
+  }
+}
@@ -0,0 +1,196 @@
+// ============================================================
+// LoopTransform.cpp -- Grid, humanise, transpose and velocity
+//
+// Runs on the main thread; the re-ordering window is file-static
+// so it stays off the stack.
+//
+// The take streams through a small window sorted by new time: a
+// note moves by at most `reach` samples, so once the input has
+// gone past an event's new time by that much, nothing still to
+// come can land before it and it can be written out.
+//
+// A note-on pulled past the loop end (onto the downbeat, say)
+// wraps round to the start with its note-off.  Those land near
+// tick 0 but turn up at the end of the input, so a first pass
+// collects them and the second merges them in; both passes draw
+// the same noise.
+// ============================================================
+
+#include "LoopTransform.h"
+#include "config.h"
+#include <math.h>
+#include <string.h>
+
+using LoopTransform::Params;
+
+static constexpr int kWindow = 128;    // events waiting to be re-ordered
+
+// --- Per-note changes ------------------------------------------
+
+// xorshift32: humanise needs noise, not quality
+static uint32_t sSeed = 0x9E3779B9u;
+
+static uint32_t nextRandom() {
+  sSeed ^= sSeed << 13;
+  sSeed ^= sSeed >> 17;
+  sSeed ^= sSeed << 5;
+  return sSeed;
+}
+
+/// Uniform in [-range, range].
+static int32_t jitter(uint32_t range) {
+  return range ? (int32_t)(nextRandom() % (2 * range + 1)) - (int32_t)range : 0;
+}
+
+/// Nearest point of the beat/div grid (exact, no rounded step).
+static uint32_t snap(uint32_t t, uint32_t beat, int div) {
+  uint64_t k = ((uint64_t)t * div + beat / 2) / beat;
+  return (uint32_t)(k * beat / div);
+}
+
+/// New time of a note-on played at `t`; may be past the loop end.
+static uint32_t moveNote(uint32_t t, const Params& p) {
+  int64_t at = t;
+  if (p.div && p.beat) at += lroundf(p.strength * (float)((int64_t)snap(t, p.beat, p.div) - t));
+  at += jitter(p.jitter);
+  if (at < 0) at = 0;
+  return (uint32_t)at;
+}
+
+static uint8_t moveVelocity(uint8_t v, const Params& p) {
+  float x = v;
+  x  = kVelocityCentre + (x - kVelocityCentre) * (1.0f - p.compress);
+  x *= p.velScale;
+  x += jitter(p.velJitter);
+  return (uint8_t)clampf(x + 0.5f, 1.0f, 127.0f);
+}
+
+/// Move, transpose and rescale `ev` (played at `ev.time`).  False
+/// if it is dropped.  `wrapped`: it went past the loop end and now
+/// sits near the start.  `shift` pairs each note-off with its
+/// note-on's move.
+static bool place(LoopEvent& ev, int32_t* shift, const Params& p, bool& wrapped) {
+  uint32_t played = ev.time;
+  bool     note   = ev.type == EVT_NOTE_ON || ev.type == EVT_NOTE_OFF;
+
+  if (ev.type == EVT_NOTE_ON) {
+    ev.time        = moveNote(played, p);
+    ev.velocity    = moveVelocity(ev.velocity, p);
+    shift[ev.note] = (int32_t)(ev.time - played);
+  } else if (ev.type == EVT_NOTE_OFF) {
+    ev.time        = played + shift[ev.note];
+    shift[ev.note] = 0;
+  }
+
+  wrapped = false;
+  if (p.length && played >= p.length) return false;
+  if (p.length && ev.time >= p.length) {
+    ev.time %= p.length;
+    wrapped = true;
+  }
+
+  int n = ev.note + (note ? p.transpose : 0);
+  if (n < 0 || n > 127) return false;
+  ev.note = (uint8_t)n;
+  return true;
+}
+
+// --- Wrapped events --------------------------------------------
+// Sorted by time, earliest first, in input order among equals.
+
+static LoopEvent sWrap[kWindow];
+static int       sWrapCount = 0;
+static int       sWrapNext  = 0;     // next to write out
+
+static bool wrapInsert(const LoopEvent& ev) {
+  if (sWrapCount == kWindow) return false;
+  int i = sWrapCount++;
+  while (i > 0 && sWrap[i - 1].time > ev.time) {
+    sWrap[i] = sWrap[i - 1];
+    i--;
+  }
+  sWrap[i] = ev;
+  return true;
+}
+
+/// Append `ev`.  Times never go backwards, even if an overfull
+/// window had to let one out early.
+static bool emit(LoopTrack& out, LoopEvent ev, uint32_t& last) {
+  if (ev.time < last) ev.time = last;
+  last = ev.time;
+  return out.append(ev);
+}
+
+/// Write the wrapped events due by `time`.
+static bool emitWrapped(LoopTrack& out, uint32_t time, uint32_t& last) {
+  bool ok = true;
+  while (ok && sWrapNext < sWrapCount && sWrap[sWrapNext].time <= time) {
+    ok = emit(out, sWrap[sWrapNext++], last);
+  }
+  return ok;
+}
+
+// --- Re-ordering window ----------------------------------------
+// Sorted by time, latest first; among equal times the older
+// event comes last, so it is written first.
+
+static LoopEvent sWin[kWindow];
+static int       sWinCount = 0;
+
+static void windowInsert(const LoopEvent& ev) {
+  int i = sWinCount++;
+  while (i > 0 && sWin[i - 1].time <= ev.time) {
+    sWin[i] = sWin[i - 1];
+    i--;
+  }
+  sWin[i] = ev;
+}
+
+/// Write the earliest waiting event, after any wrapped ones due.
+static bool windowPop(LoopTrack& out, uint32_t& last) {
+  LoopEvent ev = sWin[--sWinCount];
+  return emitWrapped(out, ev.time, last) && emit(out, ev, last);
+}
+
+// --- Pass ------------------------------------------------------
+
+bool LoopTransform::apply(const LoopTrack& in, LoopTrack& out, const Params& p) {
+  int32_t  shift[128];                   // how far each note's note-on moved
+  uint32_t reach = (p.div && p.beat) ? (uint32_t)(p.strength * p.beat / (2 * p.div)) : 0;
+  reach += p.jitter + 1;
+  uint32_t last = 0;
+  bool     ok   = true;
+  bool     wrapped;
+
+  sSeed ^= micros();
+  uint32_t seed = sSeed;
+  out.clear();
+  sWinCount  = 0;
+  sWrapCount = 0;
+  sWrapNext  = 0;
+
+  // Pass 1: only the events that wrap round
+  LoopCursor c;
+  memset(shift, 0, sizeof(shift));
+  for (in.rewind(c); c.valid; in.advance(c)) {
+    LoopEvent ev = c.next;
+    if (place(ev, shift, p, wrapped) && wrapped && !wrapInsert(ev)) return false;
+  }
+
+  // Pass 2: the same moves again, everything else through the window
+  sSeed = seed;
+  memset(shift, 0, sizeof(shift));
+  for (in.rewind(c); c.valid && ok; in.advance(c)) {
+    LoopEvent ev     = c.next;
+    uint32_t  played = ev.time;
+    bool      keep   = place(ev, shift, p, wrapped) && !wrapped;
+
+    while (ok && sWinCount > 0 && sWin[sWinCount - 1].time + reach <= played) {
+      ok = windowPop(out, last);
+    }
+    if (ok && sWinCount == kWindow) ok = windowPop(out, last);
+    if (keep) windowInsert(ev);
+  }
+  while (ok && sWinCount > 0) ok = windowPop(out, last);
+  return ok && emitWrapped(out, 0xFFFFFFFFu, last);
+}
@@ -3,215 +3,1454 @@
 //
 // Records timestamped NoteOn/NoteOff events during recording,
 // then replays them in an endless loop during playback.
-// The synth preset is "frozen" at record start so the loop
+// Playback goes to the PART_LOOP part of the shared synth
+// engine.  Its preset is "frozen" at record start so the loop
 // keeps its original timbre even if the live preset changes.
+//
+// Overdub passes are stored as extra layers in a refcounted pool
+// (LoopHistory) that also keeps undo/redo; playback merges them by
+// time through a small heap of per-layer cursors.
+//
+// In quantise mode each take is rewritten on its grid when it is
+// committed (see Quantise.h).
+//
+// Each scene is a history chain plus a Scene record; switching
+// scenes swaps the playing slot list and the record's values.
+//
+// With kLooperAudioThread, playback runs in renderBlock() inside
+// the audio ISR; the main-thread state transitions then mask the
+// audio interrupt while they touch playback state.
 // ============================================================
 
 #include "Looper.h"
 #include "MyDsp.h"
+#include "ParamMap.h"
+#include "AudioClock.h"
+#include "Metrics.h"
+#include "Log.h"
 
 // --- Constructor -----------------------------------------------
 
-Looper::Looper(MyDsp& liveSynth, MyDsp& looperSynth)
-  : live_(liveSynth)
-  , looper_(looperSynth)
+Looper::Looper(MyDsp& synth)
+  : synth_(synth)
 {
 }
 
 // --- Internal helpers ------------------------------------------
 
+static const char* eventName(uint8_t type) {
+  switch (type) {
+    case EVT_NOTE_ON:  return "NoteON";
+    case EVT_NOTE_OFF: return "NoteOFF";
+    case EVT_PROGRAM:  return "Program";
+    case EVT_BEND:     return "Bend";
+    case EVT_PRESSURE: return "Pressure";
+    default:           return "Param";
+  }
+}
+
+/// Keep the audio ISR out while the main thread changes playback
+/// state.  AudioNoInterrupts() masks only the audio interrupt, so
+/// the synth setters' own __disable_irq()/__enable_irq() pairs
+/// inside the section cannot re-open it early.
+static inline void lockPlayback() {
+  if (kLooperAudioThread) AudioNoInterrupts();
+}
+
+static inline void unlockPlayback() {
+  if (kLooperAudioThread) AudioInterrupts();
+}
+
 /// Send NoteOff for every note the looper currently has sounding.
 /// This prevents "stuck notes" on state transitions.
 void Looper::killActiveNotes() {
-  Serial.println("[LOOPER] Killing active looper notes");
-  for (int i = 0; i < 128; i++) {
-    if (notesOn_[i]) {
-      looper_.noteOff(i);
-      notesOn_[i] = false;
-    }
+  Log.println("[LOOPER] Killing active looper notes");
+  releaseLoopNotes();
+}
+
+/// Pedals are lifted, otherwise they would just defer note-offs.
+/// Bend, pressure and preset go back to where every cycle starts,
+/// and controllers still waiting are dropped.  ISR-safe.
+void Looper::resetLoopControls() {
+  synth_.setSustain(PART_LOOP, false);
+  synth_.setSostenuto(PART_LOOP, false);
+  synth_.setPitchBend(PART_LOOP, 0);
+  synth_.setPressure(PART_LOOP, 0.0f);
+  synth_.setPreset(PART_LOOP, frozenPreset_);
+  ctlDirty_ = 0;
+}
+
+/// killActiveNotes() without logging, safe in the audio ISR.
+void Looper::releaseLoopNotes() {
+  resetLoopControls();
+  for (int n = sounding_.popLowest(); n >= 0; n = sounding_.popLowest()) {
+    synth_.noteOff(PART_LOOP, n);
+  }
+}
+
+/// Loop boundary: like releaseLoopNotes(), except that notes
+/// crossing the loop point keep sounding until their note-off in
+/// the next cycle.  ISR-safe.
+void Looper::wrapLoopNotes() {
+  resetLoopControls();
+  NoteSet end = sounding_.minus(crossing_);
+  sounding_   = sounding_ & crossing_;
+  for (int n = end.popLowest(); n >= 0; n = end.popLowest()) {
+    synth_.noteOff(PART_LOOP, n);
   }
 }
 
+/// Notes some playing layer leaves open at its end and some
+/// playing layer ends before its first note-on: those cross the
+/// loop point.  Call when the playing layers change.  ISR-safe.
+void Looper::updateCrossing() {
+  NoteSet out, in;
+  for (int i = 0; i < layerCount_; i++) {
+    out = out | layer(i).crossOut();
+    in  = in  | layer(i).crossIn();
+  }
+  crossing_ = out & in;
+}
+
 /// Reset everything back to the initial empty state.
 void Looper::clear() {
-  Serial.println("[LOOPER] CLEAR");
+  Log.println("[LOOPER] CLEAR");
+  lockPlayback();
   killActiveNotes();
-  eventCount_   = 0;
-  loopLengthMs_ = 0;
-  state_        = LOOP_EMPTY;
-  playIndex_    = 0;
+  layerCount_ = 0;
+  merge_.clear();
+  loopLength_ = 0;
+  beat_       = 0;
+  syncPulses_ = 0;
+  sceneNext_  = kNoScene;
+  state_      = LOOP_EMPTY;
+  unlockPlayback();
+
+  if (recSlot_ != LoopHistory::kNone) history_.discard(recSlot_);
+  recSlot_ = LoopHistory::kNone;
+  tailNotes_.clear();
+  tailCount_ = 0;
+  releaseRetired();
+  history_.clear(scene_);
 }
 
 /// Begin recording: freeze the current live preset for the looper,
-/// reset the event buffer, and start the timestamp clock.
+/// reset the event buffer, and start the sample-clock timestamp.
 void Looper::startRecording() {
-  Serial.println("[LOOPER] START RECORDING");
+  Log.println("[LOOPER] START RECORDING");
+  finishTail();
+  lockPlayback();
   killActiveNotes();
+  layerCount_ = 0;
+  merge_.clear();
+  state_ = LOOP_RECORDING;   // the ISR stops playing from here on
+  unlockPlayback();
 
-  // Freeze the live preset into the looper synth
+  // Freeze the live preset into the loop part
   frozenPreset_ = livePreset_;
-  looper_.setPreset(frozenPreset_);
+  synth_.setPreset(PART_LOOP, frozenPreset_);
+
+  Log.print("[LOOPER] Frozen preset for loop: ");
+  Log.println(frozenPreset_);
 
-  Serial.print("[LOOPER] Frozen preset for loop: ");
-  Serial.println(frozenPreset_);
+  // The base take starts a fresh history for this scene
+  if (recSlot_ != LoopHistory::kNone) history_.discard(recSlot_);
+  history_.clear(scene_);
+  recSlot_    = history_.alloc();
+  recHeld_.clear();
+  loopLength_ = 0;
+  syncPulses_ = 0;
+  recStart_   = AudioClock::now();
 
-  eventCount_   = 0;
-  loopLengthMs_ = 0;
-  recStartMs_   = millis();
-  state_        = LOOP_RECORDING;
+  // Slaved: the loop starts on the nearest clock beat, which may
+  // be just ahead (notes played before it land on it)
+  recSynced_ = MidiClock::running();
+  if (recSynced_) {
+    recPulse_ = MidiClock::nearestBeat(recStart_);
+    recStart_ = MidiClock::pulseTime(recPulse_);
+  }
 }
 
 /// Stop recording and immediately start playback.
 /// If no events were recorded, go back to EMPTY instead.
 void Looper::stopRecordingAndPlay() {
-  if (eventCount_ <= 0) {
-    Serial.println("[LOOPER] No events recorded -> back to EMPTY");
-    state_ = LOOP_EMPTY;
+  if (history_.track(recSlot_).count() == 0) {
+    Log.println("[LOOPER] No events recorded -> back to EMPTY");
+    history_.discard(recSlot_);
+    recSlot_ = LoopHistory::kNone;
+    state_   = LOOP_EMPTY;
+    if (sceneNext_ != kNoScene) enterScene(sceneNext_);
     return;
   }
 
-  loopLengthMs_ = millis() - recStartMs_;
+  int32_t took = (int32_t)(AudioClock::now() - recStart_);
+  loopLength_ = took > 0 ? (uint32_t)took : 1;
+  beat_       = 0;
+
+  // Slaved: a whole number of clock beats
+  if (recSynced_ && MidiClock::running()) {
+    beat_       = MidiClock::beat();
+    loopLength_ = Quantise::snapLength(loopLength_, beat_);
+    syncPulses_ = loopLength_ / beat_ * MidiClock::kPulsesPerBeat;
+    syncPulse_  = recPulse_ + syncPulses_;
+
+    Log.print("[LOOPER] Synced to MIDI clock: ");
+    Log.print(loopLength_ / beat_);
+    Log.println(" beats");
+  }
+  if (quantise_) quantiseTake(true);
 
-  Serial.print("[LOOPER] STOP RECORDING. Duration: ");
-  Serial.print(loopLengthMs_);
-  Serial.print(" ms, Events: ");
-  Serial.print(eventCount_);
-  Serial.print(", Preset: ");
-  Serial.println(frozenPreset_);
+  const LoopTrack& take = history_.track(recSlot_);
+  Log.print("[LOOPER] STOP RECORDING. Duration: ");
+  Log.print(loopLength_);
+  Log.print(" samples (");
+  Log.print(AudioClock::toMs(loopLength_));
+  Log.print(" ms), Events: ");
+  Log.print(take.count());
+  Log.print(" (");
+  Log.print(take.bytes());
+  Log.print(" bytes)");
+  Log.print(", Preset: ");
+  Log.println(frozenPreset_);
 
+  history_.push(scene_, recSlot_);
+  recSlot_ = LoopHistory::kNone;
+
+  // Playback starts one loop length after the recording did: where
+  // the recording ended or, quantised, on the nearest beat to it.
+  playFromTop(syncPulses_ ? MidiClock::pulseTime(syncPulse_) : recStart_ + loopLength_);
+  startTail();
+}
+
+/// Play the committed layers with a cycle starting at `start`.  A
+/// start just ahead waits for it; one already past joins the
+/// cycle in the middle.
+void Looper::playFromTop(uint32_t start) {
+  lockPlayback();
   killActiveNotes();
-  playStartMs_ = millis();
-  playIndex_   = 0;
-  state_       = LOOP_PLAYING;
+  playStart_ = start;
+  lockCycle();
+  restartVarispeed(start);
+  resyncLayers();
+  state_     = LOOP_PLAYING;
+  unlockPlayback();
+
+  MidiClock::loopStarted(playStart_, beat_);
+}
+
+/// Move on to the next cycle at the end of the current one, in
+/// the staged scene if there is one.  The caller rewinds the layers.
+void Looper::nextCycle() {
+  playStart_ += cycleLength();
+  cycles_++;
+  if (syncPulses_) syncPulse_ += syncPulses_;
+  if (sceneNext_ != kNoScene) switchScene();
+  if (syncPulses_) lockCycle();
+}
+
+/// Slaved: stretch the cycle starting at playStart_ so it ends on
+/// the clock's predicted downbeat of the next cycle.  Without a
+/// clock, or if the prediction is far off (the clock jumped), the
+/// loop runs free at its length.  ISR-safe.
+void Looper::lockCycle() {
+  stretch_ = 0;
+  if (!syncPulses_ || !MidiClock::running()) return;
+  int32_t len = (int32_t)(MidiClock::pulseTime(syncPulse_ + syncPulses_) - playStart_);
+  int32_t off = len - (int32_t)loopLength_;
+  if (len > 0 && (uint32_t)abs(off) < loopLength_ / 16) stretch_ = off;
 }
 
 /// Stop playback (loop stays in memory and can be restarted).
 void Looper::stopPlayback() {
-  Serial.println("[LOOPER] STOP PLAYING");
+  Log.println("[LOOPER] STOP PLAYING");
+  lockPlayback();
   killActiveNotes();
   state_     = LOOP_STOPPED;
-  playIndex_ = 0;
+  unlockPlayback();
+
+  MidiClock::loopStopped();
+  if (sceneNext_ != kNoScene) enterScene(sceneNext_);   // no boundary to wait for
+}
+
+/// Restart the loop from its top and record a new layer over it.
+/// If the layer pool is full, just play.
+void Looper::startOverdub() {
+  finishTail();
+  recHeld_.clear();
+  recSlot_ = varispeed() ? LoopHistory::kNone : history_.alloc();
+  if (varispeed()) {
+    Log.println("[LOOPER] Overdub needs 1x forward -> PLAYING");
+  } else if (recSlot_ == LoopHistory::kNone) {
+    Log.println("[LOOPER] Layer pool full -> PLAYING");
+  } else {
+    Log.print("[LOOPER] START OVERDUB, layer ");
+    Log.println(layerCount_);
+  }
+
+  // Slaved, the loop restarts on the nearest clock beat
+  uint32_t start = AudioClock::now();
+  if (syncPulses_ && MidiClock::running()) {
+    syncPulse_ = MidiClock::nearestBeat(start);
+    start      = MidiClock::pulseTime(syncPulse_);
+  }
+
+  lockPlayback();
+  killActiveNotes();
+  playStart_ = start;
+  lockCycle();
+  restartVarispeed(start);
+  resyncLayers();
+  cycles_    = 0;
+  recCycle_  = 0;
+  state_     = (recSlot_ != LoopHistory::kNone) ? LOOP_OVERDUB : LOOP_PLAYING;
+  unlockPlayback();
+
+  MidiClock::loopStarted(start, beat_);
+}
+
+/// Keep the layer recorded so far and carry on playing.
+void Looper::stopOverdub() {
+  Log.println("[LOOPER] STOP OVERDUB");
+  commitLayer();
+  if (recSlot_ != LoopHistory::kNone) history_.discard(recSlot_);   // empty pass
+  recSlot_ = LoopHistory::kNone;
+  state_   = LOOP_PLAYING;
+  startTail();
+}
+
+/// Once the overdub passes a loop boundary, the layer recorded on
+/// the previous pass is committed and a fresh one is started, so
+/// each layer holds exactly one pass.  Called from the main
+/// thread (tick() and addEvent()).
+void Looper::rollOverdub(uint32_t now) {
+  uint32_t cycle;
+  overdubPosition(now, cycle);
+  if (cycle == recCycle_) return;
+  recCycle_ = cycle;
+
+  commitLayer();
+  if (recSlot_ != LoopHistory::kNone) return;   // empty pass: keep recording into it
+
+  recSlot_ = history_.alloc();
+  if (recSlot_ == LoopHistory::kNone) {
+    Log.println("[LOOPER] Layer pool full -> PLAYING");
+    state_ = LOOP_PLAYING;
+  }
+}
+
+/// Cycle position of the next sample the player will render.
+/// Call with playback locked.
+uint32_t Looper::playPosition() const {
+  uint32_t now = kLooperAudioThread ? AudioClock::blockStart() : AudioClock::now();
+  int32_t  rel = (int32_t)(now - playStart_);
+  return rel > 0 ? toLoop((uint32_t)rel % cycleLength()) : 0;
+}
+
+/// Overdub: the pass (a cycles_ value) and loop position of clock
+/// time `now`.  Timed from the playing cycle, so a layer lines up
+/// with the layers under it however the cycles were stretched.
+/// Main thread.
+uint32_t Looper::overdubPosition(uint32_t now, uint32_t& cycle) {
+  lockPlayback();
+  uint32_t start = playStart_;
+  uint32_t len   = cycleLength();
+  uint32_t n     = cycles_;
+  unlockPlayback();
+
+  int32_t rel = (int32_t)(now - start);
+  if (rel < 0) {
+    if (n == 0) {                  // early for a synced start
+      cycle = 0;
+      return 0;
+    }
+    // The player has already wrapped: `now` is the end of the last pass
+    cycle = n - 1;
+    rel  += (int32_t)len;
+    if (rel < 0) rel = 0;
+  } else {
+    cycle = n + (uint32_t)rel / len;
+    rel   = (int32_t)((uint32_t)rel % len);
+  }
+  uint32_t pos = (uint32_t)((uint64_t)rel * loopLength_ / len);
+  return pos < loopLength_ ? pos : loopLength_ - 1;
+}
+
+/// Reload the playing layers from the history head and seek every
+/// cursor to the current position (and re-stage the scene if a
+/// transform waits for the boundary).  Call with playback locked.
+void Looper::resyncLayers() {
+  layerCount_ = history_.layers(scene_, slots_);
+  if (sceneNext_ == scene_) stageScene(scene_);
+  updateCrossing();
+  seekLayers(varispeed() ? (uint32_t)((posQ_ + kRateOne - 1) >> kLoopRateShift) : playPosition());
+}
+
+/// Point the merge at the first event of every layer at or after `pos`.
+void Looper::seekLayers(uint32_t pos) {
+  merge_.clear();
+  for (int i = 0; i < layerCount_; i++) merge_.add(layer(i), pos);
+}
+
+/// Push the recording slot onto the history, making it audible
+/// from the current playback position.  An empty pass is kept in
+/// recSlot_ for reuse.
+void Looper::commitLayer() {
+  if (recSlot_ == LoopHistory::kNone) return;
+  if (history_.track(recSlot_).count() == 0) return;
+  if (quantise_ && beat_) quantiseTake(false);
+
+  const LoopTrack& rec = history_.track(recSlot_);
+  history_.push(scene_, recSlot_);
+  recSlot_ = LoopHistory::kNone;
+
+  lockPlayback();
+  resyncLayers();
+  unlockPlayback();
+
+  Log.print("[LOOPER] Layer ");
+  Log.print(layerCount_ - 1);
+  Log.print(" committed: ");
+  Log.print(rec.count());
+  Log.print(" events (");
+  Log.print(rec.bytes());
+  Log.println(" bytes)");
+}
+
+/// Snap the take in recSlot_ to its grid.  For the base take, the
+/// beat is found first and the loop length snapped to whole beats;
+/// overdubs reuse that beat.  Committed tracks are immutable, so
+/// the take is rewritten into a fresh slot -- if the pool has none,
+/// it stays as played.
+void Looper::quantiseTake(bool base) {
+  const LoopTrack& take = history_.track(recSlot_);
+
+  // Synced to a MIDI clock, the beat and length are already set
+  if (base && !beat_) {
+    beat_ = Quantise::inferBeat(take);
+    if (!beat_) {
+      Log.println("[LOOPER] Quantise: no steady tempo, take kept as played");
+      return;
+    }
+    loopLength_ = Quantise::snapLength(loopLength_, beat_);
+
+    Log.print("[LOOPER] Quantise: ");
+    Log.print(60.0f * AUDIO_SAMPLE_RATE_EXACT / beat_, 1);
+    Log.print(" BPM from note onsets, ");
+    Log.print(loopLength_ / beat_);
+    Log.println(" beats");
+  }
+
+  int     div  = Quantise::chooseDivision(take, beat_);
+  uint8_t slot = history_.alloc();
+  if (slot == LoopHistory::kNone) {
+    Log.println("[LOOPER] Quantise: layer pool full, take kept as played");
+    return;
+  }
+  if (!Quantise::apply(take, history_.track(slot), beat_, div, loopLength_)) {
+    Log.println("[LOOPER] Quantise: take does not fit, kept as played");
+    history_.discard(slot);
+    return;
+  }
+  history_.discard(recSlot_);
+  recSlot_ = slot;
+
+  if (div) {
+    Log.print("[LOOPER] Quantise: grid 1/");
+    Log.print(div);
+    Log.println(" beat");
+  } else {
+    Log.println("[LOOPER] Quantise: no grid fits, timing kept");
+  }
 }
 
-/// Append one event to the buffer (with overflow protection).
-void Looper::addEvent(uint8_t type, uint8_t note, uint8_t vel) {
-  if (eventCount_ >= kMaxLoopEvents) {
-    Serial.println("[LOOPER] !!! BUFFER FULL !!!");
+/// Append one event to the recording layer (with overflow protection).
+void Looper::addEvent(uint8_t type, uint8_t note, uint8_t vel, uint8_t fine) {
+  uint32_t now = AudioClock::now();
+  int32_t  rel = (int32_t)(now - recStart_);
+  uint32_t t   = rel > 0 ? (uint32_t)rel : 0;   // early for a synced start
+
+  // Overdub: store the position within the current pass
+  if (state_ == LOOP_OVERDUB) {
+    rollOverdub(now);
+    if (state_ != LOOP_OVERDUB) return;
+    uint32_t cycle;
+    t = overdubPosition(now, cycle);
+  }
+
+  LoopTrack& rec = history_.track(recSlot_);
+  if (!rec.append({ t, type, note, vel, fine })) {
+    Log.println("[LOOPER] !!! BUFFER FULL !!!");
     return;
   }
 
-  uint32_t t = millis() - recStartMs_;
-  events_[eventCount_++] = { t, type, note, vel };
+  if (isControlEvent(type)) return;   // too many to log
 
-  Serial.print("[LOOPER] Event #");
-  Serial.print(eventCount_);
-  Serial.print(" @ ");
-  Serial.print(t);
-  Serial.print(" ms: ");
-  Serial.print(type == EVT_NOTE_ON ? "NoteON" : "NoteOFF");
-  Serial.print(" note=");
-  Serial.println(note);
+  Log.print("[LOOPER] L");
+  Log.print(layerCount_);
+  Log.print(" event #");
+  Log.print(rec.count());
+  Log.print(" @ ");
+  Log.print(AudioClock::toMs(t));
+  Log.print(" ms: ");
+  Log.print(eventName(type));
+  Log.print(" note=");
+  Log.println(note);
 }
 
 // --- Public: state transitions ---------------------------------
 
 void Looper::onShortPress() {
-  Serial.print("[BTN] Action: SHORT PRESS. State=");
-  Serial.println(state_);
+  Log.print("[BTN] Action: SHORT PRESS. State=");
+  Log.println(state_);
 
   switch (state_) {
     case LOOP_EMPTY:
-    case LOOP_STOPPED:
-      Serial.println("[BTN] -> START RECORDING");
+      Log.println("[BTN] -> START RECORDING");
       startRecording();
       break;
 
+    case LOOP_STOPPED:
+      Log.println("[BTN] -> START OVERDUB");
+      startOverdub();
+      break;
+
+    case LOOP_OVERDUB:
+      Log.println("[BTN] -> STOP OVERDUB");
+      stopOverdub();
+      break;
+
     case LOOP_RECORDING:
-      Serial.println("[BTN] -> STOP REC, START PLAY");
+      Log.println("[BTN] -> STOP REC, START PLAY");
       stopRecordingAndPlay();
       break;
 
     case LOOP_PLAYING:
-      Serial.println("[BTN] -> STOP PLAY");
+      Log.println("[BTN] -> STOP PLAY");
       stopPlayback();
       break;
   }
 }
 
 void Looper::onLongPress() {
-  Serial.println("[BTN] Action: LONG PRESS -> CLEAR");
+  Log.println("[BTN] Action: LONG PRESS -> CLEAR");
+  clear();
+}
+
+// --- Loop-point tail ---------------------------------------------
+// A key still held when a take is committed has its note-on in
+// the take but no note-off.  Its release, during the next cycle,
+// is caught at its cycle position and merged into the take, so
+// the note crosses the loop point from then on.
+
+/// Take just committed: catch the note-offs of the keys it leaves
+/// sounding, for one cycle.
+void Looper::startTail() {
+  tailCount_ = 0;
+  tailScene_ = scene_;
+  tailSlot_  = history_.head(scene_);
+  tailNotes_.clear();
+  if (tailSlot_ != LoopHistory::kNone) tailNotes_ = recHeld_ & history_.track(tailSlot_).crossOut();
+  recHeld_.clear();
+  if (!tailNotes_.any()) return;
+
+  // A synced first cycle may start a little ahead
+  uint32_t now = AudioClock::now();
+  int32_t  wait = (int32_t)(playStart_ - now);
+  tailEnd_ = now + (wait > 0 ? (uint32_t)wait : 0) + cycleLength();
+}
+
+/// A tail key was released: note its position in the cycle.
+void Looper::captureTail(uint8_t note) {
+  tailNotes_.reset(note);
+  if (!playing() || varispeed() || scene_ != tailScene_ || tailCount_ == kTailNotes) return;
+
+  lockPlayback();
+  uint32_t pos = playPosition();
+  unlockPlayback();
+
+  int k = tailCount_++;
+  while (k > 0 && tail_[k - 1].time > pos) {
+    tail_[k] = tail_[k - 1];
+    k--;
+  }
+  tail_[k] = { pos, EVT_NOTE_OFF, note, 0, 0 };
+}
+
+/// Merge the caught note-offs into their take.  Committed layers
+/// are immutable, so the take is rewritten into a fresh slot that
+/// replaces it -- only while it is still the top layer.
+void Looper::finishTail() {
+  int n = tailCount_;
+  tailCount_ = 0;
+  tailNotes_.clear();
+  if (n == 0 || history_.head(tailScene_) != tailSlot_) return;
+
+  uint8_t slot = history_.alloc();
+  if (slot == LoopHistory::kNone) {
+    Log.println("[LOOPER] Tail: layer pool full, held notes stop at the loop point");
+    return;
+  }
+
+  // Two time-ordered runs: the take and the caught note-offs
+  const LoopTrack& in  = history_.track(tailSlot_);
+  LoopTrack&       out = history_.track(slot);
+  LoopCursor c;
+  int  k  = 0;
+  bool ok = true;
+  for (in.rewind(c); ok && (c.valid || k < n); ) {
+    bool take = c.valid && (k == n || c.next.time <= tail_[k].time);
+    ok = out.append(take ? c.next : tail_[k]);
+    if (take) in.advance(c);
+    else      k++;
+  }
+  if (!ok) {
+    Log.println("[LOOPER] Tail: layer full, held notes stop at the loop point");
+    history_.discard(slot);
+    return;
+  }
+
+  lockPlayback();
+  history_.replaceHead(tailScene_, slot);
+  if (tailScene_ == scene_)          resyncLayers();
+  else if (sceneNext_ == tailScene_) stageScene(tailScene_);
+  unlockPlayback();
+
+  Log.print("[LOOPER] Tail: ");
+  Log.print(n);
+  Log.println(" note-off(s) merged, held notes cross the loop point");
+}
+
+// --- Scenes ----------------------------------------------------
+
+/// Put `scene`'s layers in nextSlots_ for loadScene().  A chain
+/// only changes while its scene plays, so the list stays valid
+/// until the switch.
+void Looper::stageScene(uint8_t scene) {
+  nextCount_ = history_.layers(scene, nextSlots_);
+}
+
+/// Keep the playing scene's values in its record.
+void Looper::saveScene() {
+  Scene& s = scenes_[scene_];
+  s.length     = loopLength_;
+  s.beat       = beat_;
+  s.syncPulses = syncPulses_;
+  s.preset     = frozenPreset_;
+}
+
+/// Make `scene` the playing one, with the layers from
+/// stageScene().  ISR-safe.
+void Looper::loadScene(uint8_t scene) {
+  const Scene& s = scenes_[scene];
+  scene_        = scene;
+  loopLength_   = s.length;
+  stretch_      = 0;
+  beat_         = s.beat;
+  syncPulses_   = s.syncPulses;
+  frozenPreset_ = s.preset;
+  layerCount_   = nextCount_;
+  for (int i = 0; i < nextCount_; i++) slots_[i] = nextSlots_[i];
+  updateCrossing();
+  synth_.setPreset(PART_LOOP, frozenPreset_);
+}
+
+/// Loop boundary with a scene staged: swap it in.  An empty scene
+/// stops playback.  Runs in the audio ISR (or tick()); tick()
+/// reports the switch afterwards.
+void Looper::switchScene() {
+  bool synced = syncPulses_ != 0;
+  releaseLoopNotes();          // crossing notes belong to the old scene
+  saveScene();
+  loadScene(sceneNext_);
+  sceneNext_    = kNoScene;
+  sceneEntered_ = true;
+  if (layerCount_ == 0) {
+    merge_.clear();
+    state_ = LOOP_EMPTY;
+  } else if (syncPulses_ && !synced && MidiClock::running()) {
+    syncPulse_ = MidiClock::nearestBeat(playStart_);   // join the clock's beats
+  }
+}
+
+/// Switch right away: nothing is playing.
+void Looper::enterScene(uint8_t scene) {
+  lockPlayback();
+  killActiveNotes();
+  stageScene(scene);
+  saveScene();
+  loadScene(scene);
+  sceneNext_ = kNoScene;
+  merge_.clear();
+  state_     = layerCount_ ? LOOP_STOPPED : LOOP_EMPTY;
+  unlockPlayback();
+  releaseRetired();
+  shownScene_ = scene;
+
+  Log.print("[LOOPER] Scene ");
+  Log.print(scene + 1);
+  Log.println(state_ == LOOP_EMPTY ? " (empty) -> EMPTY" : " -> STOPPED");
+}
+
+/// Log a switch made on the loop boundary and re-phase the clock.
+/// The layers it replaced are no longer playing.
+void Looper::reportScene() {
+  sceneEntered_ = false;
+  lockPlayback();
+  uint32_t start = playStart_;
+  unlockPlayback();
+  releaseRetired();
+
+  if (scene_ == shownScene_) {
+    Log.println("[LOOPER] Transformed loop playing");
+    return;
+  }
+  shownScene_ = scene_;
+  Log.print("[LOOPER] Scene ");
+  Log.print(scene_ + 1);
+  if (state_ == LOOP_EMPTY) {
+    Log.println(" (empty) -> EMPTY");
+    MidiClock::loopStopped();
+    return;
+  }
+  Log.print(": ");
+  Log.print(layerCount_);
+  Log.println(" layers");
+  MidiClock::loopStarted(start, beat_);
+}
+
+void Looper::selectScene(int scene) {
+  if (scene < 0 || scene >= kLoopScenes) return;
+  if (state_ == LOOP_OVERDUB) stopOverdub();   // the pass so far stays in this scene
+
+  if (state_ != LOOP_PLAYING && state_ != LOOP_RECORDING) {
+    if (scene != scene_) enterScene(scene);
+    return;
+  }
+
+  // Stage it; the player swaps it in on the loop boundary.  Back
+  // to the playing scene cancels the switch, but not a transform.
+  lockPlayback();
+  bool same = scene == scene_;
+  if (same && !transformPending_) {
+    sceneNext_ = kNoScene;
+  } else {
+    stageScene(scene);
+    sceneNext_ = scene;
+  }
+  unlockPlayback();
+
+  Log.print("[LOOPER] Scene ");
+  Log.print(scene + 1);
+  Log.println(same ? ": pending switch cancelled" : " at the loop boundary");
+}
+
+void Looper::nextScene() {
+  uint8_t from = (sceneNext_ != kNoScene) ? sceneNext_ : scene_;
+  selectScene((from + 1) % kLoopScenes);
+}
+
+// --- Loop transforms -------------------------------------------
+// The old layers are pinned in retired_ before the scene's history
+// takes the rewritten ones, and released once the ISR has moved
+// past them: on the next switch, or right away when stopped.
+
+void Looper::releaseRetired() {
+  for (int i = 0; i < retiredCount_; i++) history_.release(retired_[i]);
+  retiredCount_     = 0;
+  transformPending_ = false;
+}
+
+void Looper::applyTransform(LoopTransform::Params& p, const char* what) {
+  if (state_ == LOOP_OVERDUB) stopOverdub();
+  if (state_ != LOOP_PLAYING && state_ != LOOP_STOPPED) return;
+  if (sceneEntered_) reportScene();          // retire a finished swap first
+  if (transformPending_) {
+    Log.print("[LOOPER] ");
+    Log.print(what);
+    Log.println(": previous transform still pending, ignored");
+    return;
+  }
+  finishTail();
+
+  uint8_t old[kLoopPoolTracks], fresh[kLoopPoolTracks];
+  int     n = history_.layers(scene_, old);
+  p.length  = loopLength_;
+  for (int i = 0; i < n; i++) {
+    if (p.beat) {
+      int div = Quantise::chooseDivision(history_.track(old[i]), p.beat);
+      p.div   = div ? div : 4;                // played freely: sixteenths
+    }
+    fresh[i] = history_.alloc();
+    bool ok  = fresh[i] != LoopHistory::kNone
+            && LoopTransform::apply(history_.track(old[i]), history_.track(fresh[i]), p);
+    if (!ok) {
+      if (fresh[i] != LoopHistory::kNone) history_.discard(fresh[i]);
+      while (i > 0) history_.discard(fresh[--i]);
+      Log.print("[LOOPER] ");
+      Log.print(what);
+      Log.println(": no room for the rewritten layers");
+      return;
+    }
+  }
+
+  lockPlayback();
+  for (int i = 0; i < n; i++) {
+    history_.retain(old[i]);
+    retired_[i] = old[i];
+  }
+  retiredCount_ = n;
+  history_.replaceAll(scene_, fresh, n);
+  bool wait = state_ == LOOP_PLAYING;
+  if (wait) {
+    transformPending_ = true;
+    if (sceneNext_ == kNoScene) sceneNext_ = scene_;
+    if (sceneNext_ == scene_)   stageScene(scene_);
+  } else {
+    resyncLayers();
+  }
+  unlockPlayback();
+  if (!wait) releaseRetired();
+
+  Log.print("[LOOPER] ");
+  Log.print(what);
+  Log.print(": ");
+  Log.print(n);
+  Log.println(wait ? " layers rewritten, in at the loop boundary" : " layers rewritten");
+}
+
+void Looper::quantiseLoop(float strength) {
+  if (state_ != LOOP_PLAYING && state_ != LOOP_STOPPED && state_ != LOOP_OVERDUB) return;
+  if (!beat_) beat_ = Quantise::inferBeat(layer(0));
+  if (!beat_) {
+    Log.println("[LOOPER] Grid: no steady tempo, loop unchanged");
+    return;
+  }
+  LoopTransform::Params p;
+  p.beat     = beat_;
+  p.strength = clampf(strength, 0.0f, 1.0f);
+  applyTransform(p, "Grid");
+}
+
+void Looper::humaniseLoop(float amount) {
+  amount = clampf(amount, 0.0f, 1.0f);
+  LoopTransform::Params p;
+  p.jitter    = AudioClock::fromMs((uint32_t)(amount * kHumaniseMaxMs + 0.5f));
+  p.velJitter = (uint8_t)(amount * kHumaniseMaxVel + 0.5f);
+  applyTransform(p, "Humanise");
+}
+
+void Looper::transposeLoop(int semitones) {
+  LoopTransform::Params p;
+  p.transpose = semitones < -kTransposeMax ? -kTransposeMax
+              : semitones >  kTransposeMax ?  kTransposeMax : semitones;
+  applyTransform(p, "Transpose");
+}
+
+void Looper::scaleVelocity(float gain) {
+  LoopTransform::Params p;
+  p.velScale = gain > 0.0f ? gain : 0.0f;
+  applyTransform(p, "Velocity");
+}
+
+void Looper::compressVelocity(float amount) {
+  LoopTransform::Params p;
+  p.compress = clampf(amount, 0.0f, 1.0f);
+  applyTransform(p, "Compress");
+}
+
+// --- Public: MIDI clock transport ------------------------------
+
+void Looper::onClockStart() {
+  if (!syncPulses_ || (state_ != LOOP_PLAYING && state_ != LOOP_STOPPED)) return;
+  uint32_t at   = MidiClock::startPulse();
+  uint32_t into = at % syncPulses_;
+  Log.print("[LOOPER] Clock start -> PLAY from pulse ");
+  Log.println(into);
+
+  // The cycle began `into` pulses back: from the fit when it is
+  // trusted, else from the pulse just received at the loop's beat
+  syncPulse_ = at - into;
+  playFromTop(MidiClock::running()
+              ? MidiClock::pulseTime(syncPulse_)
+              : MidiClock::lastPulse() - (uint32_t)((uint64_t)into * beat_ / MidiClock::kPulsesPerBeat));
+}
+
+void Looper::onClockStop() {
+  if (!syncPulses_) return;
+  if (state_ == LOOP_OVERDUB) stopOverdub();
+  if (state_ == LOOP_PLAYING) stopPlayback();
+}
+
+// --- Public: persistence ---------------------------------------
+
+bool Looper::openSnapshot(Snapshot& snap) {
+  if (layerCount_ == 0 || loopLength_ == 0) return false;
+
+  snap.count  = layerCount_;
+  snap.length = loopLength_;
+  snap.preset = frozenPreset_;
+  snap.merge.clear();
+  for (int i = 0; i < snap.count; i++) {
+    snap.slots[i] = slots_[i];
+    history_.retain(slots_[i]);
+    snap.merge.add(history_.track(slots_[i]));
+  }
+  return true;
+}
+
+void Looper::closeSnapshot(Snapshot& snap) {
+  for (int i = 0; i < snap.count; i++) history_.release(snap.slots[i]);
+  snap.count = 0;
+  snap.merge.clear();
+}
+
+bool Looper::beginImport() {
   clear();
+  recSlot_ = history_.alloc();
+  return recSlot_ != LoopHistory::kNone;
+}
+
+bool Looper::importEvent(const LoopEvent& ev) {
+  if (recSlot_ == LoopHistory::kNone) return false;
+  return history_.track(recSlot_).append(ev);
+}
+
+void Looper::importPreset(int preset) {
+  frozenPreset_ = preset;
+  synth_.setPreset(PART_LOOP, preset);
+}
+
+/// Commit the imported layer.  The loop is at least as long as
+/// its events, even if the file's End of Track came earlier.
+bool Looper::endImport(uint32_t length) {
+  if (recSlot_ == LoopHistory::kNone) return false;
+  LoopTrack& take = history_.track(recSlot_);
+  if (take.count() == 0) {
+    history_.discard(recSlot_);
+    recSlot_ = LoopHistory::kNone;
+    return false;
+  }
+
+  uint32_t last = take.lastTime();
+  loopLength_ = (length > last) ? length : last + (1u << kLoopTickShift);
+
+  history_.push(scene_, recSlot_);
+  recSlot_ = LoopHistory::kNone;
+  playFromTop(AudioClock::now());
+  return true;
+}
+
+// --- Public: layer history -------------------------------------
+
+void Looper::undo() {
+  if (state_ == LOOP_OVERDUB) {
+    Log.println("[LOOPER] UNDO: overdub pass dropped -> PLAYING");
+    history_.discard(recSlot_);
+    recSlot_ = LoopHistory::kNone;
+    state_   = LOOP_PLAYING;
+    return;
+  }
+  if (state_ != LOOP_PLAYING && state_ != LOOP_STOPPED) return;
+  finishTail();
+
+  lockPlayback();
+  bool ok = history_.undo(scene_);
+  if (ok) {
+    releaseLoopNotes();
+    resyncLayers();
+  }
+  unlockPlayback();
+
+  Log.print(ok ? "[LOOPER] UNDO -> layers: " : "[LOOPER] Nothing to undo, layers: ");
+  Log.println(layerCount_);
+}
+
+void Looper::redo() {
+  if (!playing() && state_ != LOOP_STOPPED) return;
+  finishTail();
+
+  lockPlayback();
+  bool ok = history_.redo(scene_);
+  if (ok) {
+    releaseLoopNotes();
+    resyncLayers();
+  }
+  unlockPlayback();
+
+  Log.print(ok ? "[LOOPER] REDO -> layers: " : "[LOOPER] Nothing to redo, layers: ");
+  Log.println(layerCount_);
 }
 
 // --- Public: MIDI event recording ------------------------------
 
 void Looper::recordNoteOn(uint8_t note, uint8_t vel) {
-  if (state_ != LOOP_RECORDING) return;
-  looper_.noteOn(note, vel);
+  if (!recording()) return;
+  recHeld_.set(note);
   addEvent(EVT_NOTE_ON, note, vel);
 }
 
 void Looper::recordNoteOff(uint8_t note) {
-  if (state_ != LOOP_RECORDING) return;
-  looper_.noteOff(note);
+  if (!recording()) {
+    if (tailNotes_.test(note)) captureTail(note);
+    return;
+  }
+  recHeld_.reset(note);
   addEvent(EVT_NOTE_OFF, note, 0);
 }
 
+void Looper::recordParam(uint8_t id, float x01) {
+  if (!recording() || id >= PARAM_COUNT) return;
+  uint16_t v14 = (uint16_t)(clampf(x01, 0.0f, 1.0f) * 16383.0f + 0.5f);
+  addEvent(EVT_PARAM, id, v14 >> 7, v14 & 0x7F);
+}
+
+void Looper::recordProgram(int preset) {
+  if (!recording()) return;
+  addEvent(EVT_PROGRAM, preset & 0x7F, 0);
+}
+
+void Looper::recordPitchBend(uint16_t value) {
+  if (!recording()) return;
+  addEvent(EVT_BEND, value & 0x7F, (value >> 7) & 0x7F);
+}
+
+void Looper::recordPressure(uint8_t value) {
+  if (!recording()) return;
+  addEvent(EVT_PRESSURE, value & 0x7F, 0);
+}
+
+
+void Looper::setQuantise(bool on) {
+  quantise_ = on;
+  Log.print("[LOOPER] Quantise ");
+  Log.println(on ? "ON" : "OFF");
+}
+
 void Looper::setLivePreset(int preset) {
   livePreset_ = preset;
+}
+
+// --- Public: playback tick -------------------------------------
+
+/// Send one recorded event to the loop part.
+void Looper::playEvent(const LoopEvent& ev) {
+  switch (ev.type) {
+    case EVT_NOTE_ON:
+      synth_.noteOn(PART_LOOP, ev.note, ev.velocity);
+      sounding_.set(ev.note);
+      break;
+    case EVT_NOTE_OFF:
+      synth_.noteOff(PART_LOOP, ev.note);
+      sounding_.reset(ev.note);
+      break;
+    case EVT_PARAM: {
+      const ParamDesc& d = ParamMap::desc(ev.note);
+      d.apply(synth_, PART_LOOP, ParamMap::scale(d, ((ev.velocity << 7) | ev.fine) / 16383.0f));
+      break;
+    }
+    case EVT_PROGRAM:
+      synth_.setPreset(PART_LOOP, ev.note);
+      break;
+    case EVT_BEND:
+      synth_.setPitchBend(PART_LOOP, ((ev.velocity << 7) | ev.note) - 8192);
+      break;
+    case EVT_PRESSURE:
+      synth_.setPressure(PART_LOOP, ev.note / 127.0f);
+      break;
+  }
+}
+
+// --- Controller coalescing -------------------------------------
+// A fader or bend sweep records a value every few milliseconds.
+// Replaying each one would call the synth setters (and take the
+// IRQ lock) many times per audio block for no audible gain, so
+// controller events are parked per controller and applied once,
+// with the latest value, before the next note or at block end.
 
-  // If currently recording, update the looper synth too
-  if (state_ == LOOP_RECORDING) {
-    frozenPreset_ = preset;
-    looper_.setPreset(preset);
-    Serial.print("[LOOPER] Preset changed during recording: ");
-    Serial.println(preset);
+void Looper::queueControl(const LoopEvent& ev) {
+  uint8_t slot = (ev.type == EVT_BEND)     ? CTL_BEND
+               : (ev.type == EVT_PRESSURE) ? CTL_PRESSURE
+               : ev.note;
+  if (slot >= CTL_COUNT) return;
+  ctlEvent_[slot] = ev;
+  ctlDirty_ |= 1u << slot;
+}
+
+void Looper::flushControls() {
+  uint32_t dirty = ctlDirty_;
+  ctlDirty_ = 0;
+  while (dirty) {
+    int slot = __builtin_ctz(dirty);
+    dirty &= dirty - 1;
+    playEvent(ctlEvent_[slot]);
   }
 }
 
-// --- Public: playback tick -------------------------------------
+/// ISR path: notes and presets land on their exact sample offset;
+/// controllers parked before them are applied first, at the
+/// offset of the latest one.
+void Looper::playEventAt(const LoopEvent& ev, uint32_t offset) {
+  if (isControlEvent(ev.type)) {
+    queueControl(ev);
+    ctlAt_ = offset;
+    return;
+  }
+  if (ctlDirty_) {
+    synth_.renderTo(ctlAt_);
+    flushControls();
+  }
+  synth_.renderTo(offset);
+  playEvent(ev);
+}
+
+/// Rewind every playing layer into the merge.
+void Looper::mergeReset() {
+  merge_.clear();
+  for (int i = 0; i < layerCount_; i++) merge_.add(layer(i));
+}
+
+/// Replay every not-yet-played event with a timestamp <= `pos`.
+void Looper::playEventsUntil(uint32_t pos) {
+  for (const LoopEvent* ev = merge_.peek(); ev && ev->time <= pos; ev = merge_.peek()) {
+    if (isControlEvent(ev->type)) {
+      queueControl(*ev);
+      merge_.advance();
+      continue;
+    }
+
+    Log.print("[LOOPER] Playing L");
+    Log.print(merge_.topTrack());
+    Log.print(" event #");
+    Log.print(merge_.topIndex());
+    Log.print(" @ ");
+    Log.print(AudioClock::toMs(pos));
+    Log.print(" ms: ");
+    Log.print(eventName(ev->type));
+    Log.print(" note=");
+    Log.println(ev->note);
+
+    flushControls();
+    playEvent(*ev);
+    merge_.advance();
+  }
+  flushControls();
+}
 
 void Looper::tick() {
-  if (state_ != LOOP_PLAYING || eventCount_ <= 0) return;
+  uint32_t now = AudioClock::now();
+  if (kLooperAudioThread && lastTick_ && now - lastTick_ > AUDIO_BLOCK_SAMPLES) {
+    Metrics::looperLate(now - lastTick_ - AUDIO_BLOCK_SAMPLES);   // a block went by untended
+  }
+  lastTick_ = now;
 
-  uint32_t now     = millis();
-  uint32_t elapsed = now - playStartMs_;
+  if (sceneEntered_) reportScene();
+  if (state_ == LOOP_OVERDUB) rollOverdub(AudioClock::now());
+  if (tailCount_ || tailNotes_.any()) {
+    if (!tailNotes_.any() || (int32_t)(AudioClock::now() - tailEnd_) >= 0) finishTail();
+  }
+  if (kLooperAudioThread) return;   // renderBlock() does the work
+  if (!playing() || layerCount_ == 0 || loopLength_ == 0) return;
 
-  // Wrap around: when we reach the end of the loop, rewind
-  if (elapsed >= loopLengthMs_) {
-    Serial.print("[LOOPER] Loop finished (");
-    Serial.print(elapsed);
-    Serial.print("/");
-    Serial.print(loopLengthMs_);
-    Serial.println(" ms) -> REWIND");
+  if (varispeed()) {
+    int32_t due = (int32_t)(AudioClock::now() - varLast_);
+    if (due <= 0) return;
+    varLast_ += due;
+    runVarispeed((uint32_t)due);
+    return;
+  }
 
-    killActiveNotes();
-    playStartMs_ = millis();
-    playIndex_   = 0;
-    elapsed      = 0;
+  int32_t rel = (int32_t)(AudioClock::now() - playStart_);
+  if (rel < 0) return;              // first cycle not started yet
+  uint32_t elapsed = (uint32_t)rel;
+
+  const LoopEvent* next = merge_.peek();
+  if (next && toCycle(next->time) <= elapsed) Metrics::looperLate(elapsed - toCycle(next->time));
+
+  // Wrap around: finish the cycle that just ended, then move the
+  // start forward by exactly one cycle.  The start is never
+  // re-read from the clock, so the loop cannot drift, however
+  // late this tick runs.
+  while (elapsed >= cycleLength()) {
+    playEventsUntil(loopLength_);
+
+    Log.print("[LOOPER] Loop finished (");
+    Log.print(cycleLength());
+    Log.println(" samples) -> REWIND");
+
+    wrapLoopNotes();
+    elapsed -= cycleLength();
+    nextCycle();
+    if (!playing()) return;         // switched to an empty scene
+    mergeReset();
   }
 
   // Replay all events whose timestamp has been reached
-  while (playIndex_ < eventCount_ && events_[playIndex_].timeMs <= elapsed) {
-    const LoopEvent& ev = events_[playIndex_];
-
-    Serial.print("[LOOPER] Playing event #");
-    Serial.print(playIndex_);
-    Serial.print(" @ ");
-    Serial.print(elapsed);
-    Serial.print(" ms: ");
-    Serial.print(ev.type == EVT_NOTE_ON ? "NoteON" : "NoteOFF");
-    Serial.print(" note=");
-    Serial.println(ev.note);
-
-    if (ev.type == EVT_NOTE_ON) {
-      looper_.noteOn(ev.note, ev.velocity);
-      notesOn_[ev.note] = true;
-    } else if (ev.type == EVT_NOTE_OFF) {
-      looper_.noteOff(ev.note);
-      notesOn_[ev.note] = false;
+  playEventsUntil(toLoop(elapsed));
+}
+
+// --- Audio-thread playback (ISR) -------------------------------
+
+/// Play every event that falls inside the block starting at AudioClock
+/// sample `blockStart`.  Before each event the synth renders up to
+/// the event's offset, so notes start and stop on their exact
+/// sample; a wrap inside the block is handled the same way.
+/// Positions here are clock offsets into the cycle (toCycle()).
+/// Controllers are coalesced (see playEventAt()).
+/// Runs in the audio ISR: no logging here.
+void Looper::renderBlock(uint32_t blockStart) {
+  if (!playing() || layerCount_ == 0 || loopLength_ == 0) return;
+
+  const uint32_t n = AUDIO_BLOCK_SAMPLES;
+  if (varispeed()) {
+    runVarispeed(n);
+    return;
+  }
+
+  // Cycle position of the block's first sample.  Just after
+  // stopRecordingAndPlay() the cycle may start inside this block,
+  // or -- quantised -- a little later.
+  int32_t  rel = (int32_t)(blockStart - playStart_);
+  uint32_t off = 0;
+  if (rel < 0) {
+    if ((uint32_t)(-rel) >= n) return;
+    off = (uint32_t)(-rel);
+    rel = 0;
+  }
+  uint32_t pos = (uint32_t)rel;
+  uint32_t len = cycleLength();
+
+  while (off < n) {
+    uint32_t span = n - off;
+    if (span > len - pos) span = len - pos;
+
+    // Events due in [pos, pos + span), at their block offsets.
+    // Anything already overdue lands at the current offset.
+    for (const LoopEvent* ev = merge_.peek(); ev; ev = merge_.peek()) {
+      uint32_t t = toCycle(ev->time);
+      if (t >= pos + span) break;
+      playEventAt(*ev, off + (t > pos ? t - pos : 0));
+      merge_.advance();
     }
+    if (ctlDirty_) {
+      synth_.renderTo(ctlAt_);
+      flushControls();
+    }
+    off += span;
+    pos += span;
+
+    // Wrap exactly on the loop boundary
+    if (pos >= len) {
+      synth_.renderTo(off);
+      wrapLoopNotes();
+      nextCycle();
+      if (!playing()) return;       // switched to an empty scene
+      mergeReset();
+      pos         = 0;
+      len         = cycleLength();
+    }
+  }
+}
+
+// --- Speed and reverse -----------------------------------------
+
+void Looper::setSpeed(uint32_t rate, bool reverse) {
+  if (rate < kRateOne / 4) rate = kRateOne / 4;
+  if (rate > kRateOne * 4) rate = kRateOne * 4;
+  if (rate == rate_ && reverse == reverse_) return;
+  if (state_ == LOOP_OVERDUB) stopOverdub();   // layers are recorded at 1x forward
+
+  lockPlayback();
+  bool     flip = reverse != reverse_;
+  uint64_t pos  = varispeed() ? posQ_
+                : loopLength_ ? (uint64_t)playPosition() << kLoopRateShift : 0;
+  rate_    = rate;
+  reverse_ = reverse;
+  if (flip) releaseLoopNotes();           // their note-offs are behind us now
+
+  if (varispeed()) {
+    posQ_ = pos;
+    if (reverse_ && posQ_ == 0) posQ_ = (uint64_t)loopLength_ << kLoopRateShift;
+    if (!reverse_ && flip) resyncLayers();
+    varLast_ = AudioClock::now();
+  } else {
+    // Back to 1x forward: the sample clock takes over from here
+    uint32_t now = kLooperAudioThread ? AudioClock::blockStart() : AudioClock::now();
+    playStart_ = now - toCycle((uint32_t)(pos >> kLoopRateShift));
+    resyncLayers();
+  }
+  unlockPlayback();
+
+  Log.print("[LOOPER] Speed x");
+  Log.print((float)rate_ / kRateOne, 3);
+  Log.println(reverse_ ? " REVERSE" : "");
+}
+
+/// Varispeed position for a cycle starting from the top.
+void Looper::restartVarispeed(uint32_t start) {
+  posQ_    = reverse_ ? (uint64_t)loopLength_ << kLoopRateShift : 0;
+  varLast_ = start;
+}
 
-    playIndex_++;
+/// ISR: at its block offset; tick(): right away.
+void Looper::playVarispeed(const LoopEvent& ev, uint32_t offset) {
+  if (kLooperAudioThread) {
+    playEventAt(ev, offset);
+  } else if (isControlEvent(ev.type)) {
+    queueControl(ev);
+  } else {
+    flushControls();
+    playEvent(ev);
+  }
+}
+
+/// Reverse: collect every layer's events with lo <= time < hi into
+/// revEvents_, latest first (and among equal times, the later one
+/// in the track first), turned around: a note-on becomes a
+/// note-off, a note-off the note-on it ends.
+///
+/// A window that overflows keeps the latest events and returns
+/// the time it got down to: the caller plays them and gathers
+/// again below that.  Only if more than kReverseWindow events
+/// share one time are some lost, note-ons first; the notes of any
+/// note-offs lost are left in revLost_ so none is left hanging.
+/// Returns `lo` when everything fitted.
+uint32_t Looper::gatherReverse(uint32_t lo, uint32_t hi) {
+  bool     over    = false;
+  uint32_t dropped = 0;                 // latest time not kept
+  revCount_ = 0;
+  revLost_.clear();
+
+  for (int i = 0; i < layerCount_; i++) {
+    const LoopTrack& track = layer(i);
+    LoopCursor c;
+    for (track.seek(c, lo); c.valid && c.next.time < hi; track.advance(c)) {
+      LoopEvent ev = c.next;
+      if (ev.type == EVT_NOTE_ON) {
+        ev.type     = EVT_NOTE_OFF;
+        ev.velocity = 0;
+      } else if (ev.type == EVT_NOTE_OFF) {
+        ev.type     = EVT_NOTE_ON;
+        ev.velocity = track.pairedVelocity(c.index);
+        if (ev.velocity == 0) continue;     // it ended nothing
+      }
+
+      if (revCount_ == kReverseWindow) {
+        // Full: make room by dropping the earliest event, but not a
+        // note-off for anything else at the same time
+        int      victim = revCount_ - 1;
+        uint32_t oldest = revEvents_[victim].time;
+        if (ev.time == oldest) {
+          victim = -1;
+          if (ev.type == EVT_NOTE_OFF) {
+            for (int k = revCount_ - 1; k >= 0 && revEvents_[k].time == oldest; k--) {
+              if (revEvents_[k].type != EVT_NOTE_OFF) { victim = k; break; }
+            }
+          }
+        } else if (ev.time < oldest) {
+          victim = -1;
+        }
+        const LoopEvent& lost = victim < 0 ? ev : revEvents_[victim];
+        if (!over || lost.time > dropped) {
+          dropped = lost.time;
+          revLost_.clear();
+        }
+        if (lost.time == dropped && lost.type == EVT_NOTE_OFF) revLost_.set(lost.note);
+        over = true;
+        if (victim < 0) continue;
+        for (int k = victim; k < revCount_ - 1; k++) revEvents_[k] = revEvents_[k + 1];
+        revCount_--;
+      }
+
+      int k = revCount_++;
+      while (k > 0 && revEvents_[k - 1].time <= ev.time) {
+        revEvents_[k] = revEvents_[k - 1];
+        k--;
+      }
+      revEvents_[k] = ev;
+    }
+  }
+  if (!over) return lo;
+
+  // Hand back the events at the cut time too, so the next pass
+  // gathers that time whole -- unless they are all there is
+  int kept = revCount_;
+  while (kept > 0 && revEvents_[kept - 1].time <= dropped) kept--;
+  if (kept == 0) return dropped;
+  revCount_ = kept;
+  revLost_.clear();
+  return dropped + 1;
+}
+
+/// Play `samples` output samples away from 1x forward.  The loop
+/// position advances by rate_ (Q16.16) per sample -- backwards in
+/// reverse -- and each event plays at the output offset where the
+/// position reaches it.  The fraction carries across wraps, so the
+/// loop keeps its exact length at any rate.
+void Looper::runVarispeed(uint32_t samples) {
+  uint64_t       len = (uint64_t)loopLength_ << kLoopRateShift;
+  const uint32_t one = kRateOne - 1;      // rounds positions / offsets up
+  uint32_t off = 0;
+
+  while (off < samples) {
+    // Output samples until the wrap, or the rest
+    uint64_t room = reverse_ ? posQ_ : len - posQ_;
+    uint32_t span = samples - off;
+    if ((uint64_t)span * rate_ >= room) span = (uint32_t)((room + rate_ - 1) / rate_);
+    uint64_t adv  = (uint64_t)span * rate_;
+
+    if (!reverse_) {
+      uint64_t end = posQ_ + adv;
+      for (const LoopEvent* ev = merge_.peek();
+           ev && ((uint64_t)ev->time << kLoopRateShift) < end; ev = merge_.peek()) {
+        uint64_t at = (uint64_t)ev->time << kLoopRateShift;
+        uint32_t k  = at > posQ_ ? (uint32_t)((at - posQ_ + rate_ - 1) / rate_) : 0;
+        playVarispeed(*ev, off + k);
+        merge_.advance();
+      }
+      posQ_ = end;
+    } else {
+      uint64_t lo     = posQ_ > adv ? posQ_ - adv : 0;
+      uint32_t bottom = (uint32_t)((lo + one) >> kLoopRateShift);
+      uint32_t top    = (uint32_t)((posQ_ + one) >> kLoopRateShift);
+      while (top > bottom) {               // a pass per window-full, latest first
+        top = gatherReverse(bottom, top);
+        uint32_t k = 0;
+        for (int i = 0; i < revCount_; i++) {
+          uint64_t at = (uint64_t)revEvents_[i].time << kLoopRateShift;
+          k = posQ_ > at ? (uint32_t)((posQ_ - at + rate_ - 1) / rate_) : 0;
+          playVarispeed(revEvents_[i], off + k);
+        }
+        for (int n = revLost_.popLowest(); n >= 0; n = revLost_.popLowest()) {
+          playVarispeed({ top, EVT_NOTE_OFF, (uint8_t)n, 0, 0 }, off + k);
+        }
+      }
+      posQ_ = posQ_ > adv ? posQ_ - adv : 0;
+    }
+
+    if (ctlDirty_) {
+      if (kLooperAudioThread) synth_.renderTo(ctlAt_);
+      flushControls();
+    }
+    off += span;
+
+    // Wrap, keeping the overshoot, into the staged scene if any
+    bool wrapped = reverse_ ? adv >= room : posQ_ >= len;
+    if (wrapped) {
+      if (kLooperAudioThread) synth_.renderTo(off);
+      if (reverse_) releaseLoopNotes();    // crossings only hold going forward
+      else          wrapLoopNotes();
+      uint64_t over = reverse_ ? adv - room : posQ_ - len;
+      if (sceneNext_ != kNoScene) {
+        switchScene();
+        if (!playing()) return;
+        len = (uint64_t)loopLength_ << kLoopRateShift;
+      }
+      if (reverse_) {
+        posQ_ = len - over;
+      } else {
+        posQ_ = over;
+        mergeReset();
+      }
+    }
   }
 }
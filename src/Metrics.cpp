@@ -0,0 +1,202 @@
+// ============================================================
+// Metrics.cpp -- Counters, SysEx reply and text report
+//
+// The audio-side counters are written in the ISR and copied out
+// by read() with interrupts off, so a report never mixes two
+// blocks.  Teensy 4 starts ARM_DWT_CYCCNT at boot; cycles are
+// turned into us with F_CPU_ACTUAL, so a changed CPU clock still
+// reports real time.
+// ============================================================
+
+#include "Metrics.h"
+#include "Log.h"
+#include <Audio.h>
+
+// --- Audio ISR side --------------------------------------------
+
+// Cycles in one block at the nominal clock.  audioBlock() runs from
+// AudioMemory() on, before begin() can measure F_CPU_ACTUAL, so the
+// histogram has a sane bucket width from the first block.
+static constexpr uint32_t kNominalBlockPeriod =
+  (uint32_t)((double)F_CPU * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT);
+static_assert(kNominalBlockPeriod >= kMetricsBuckets, "block period too short to bucket");
+
+static uint32_t sBlockPeriod  = kNominalBlockPeriod;                    // cycles in one block
+static uint32_t sBucketCycles = kNominalBlockPeriod / kMetricsBuckets;  // histogram bucket width
+static volatile uint32_t sBlocks   = 0;
+static volatile uint32_t sBlockMin = 0xFFFFFFFFu;
+static volatile uint32_t sBlockMax = 0;
+static volatile uint32_t sHist[kMetricsBuckets];
+static volatile uint32_t sSteals   = 0;
+
+// --- Main-thread side ------------------------------------------
+
+static uint32_t sLoopMax    = 0;   // cycles
+static uint64_t sLoopSum    = 0;
+static uint32_t sLoopCount  = 0;
+static uint32_t sMidiCount  = 0;   // this second so far
+static uint32_t sMidiRate   = 0;   // last full second
+static uint32_t sMidiSecond = 0;   // millis() the second began
+static uint32_t sLateMax    = 0;   // samples
+
+static uint32_t cyclesToUs(uint64_t cycles) {
+  return (uint32_t)(cycles / (F_CPU_ACTUAL / 1000000));
+}
+
+void Metrics::begin() {
+  uint32_t period = (uint32_t)((float)F_CPU_ACTUAL * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT);
+  if (period < (uint32_t)kMetricsBuckets) period = kNominalBlockPeriod;
+  __disable_irq();
+  sBlockPeriod  = period;
+  sBucketCycles = period / kMetricsBuckets;
+  __enable_irq();
+  sMidiSecond  = millis();
+  Serial.print("[METRICS] Block period ");
+  Serial.print(sBlockPeriod);
+  Serial.println(" cycles ('?' on serial for a report)");
+}
+
+void Metrics::audioBlock(uint32_t cycles) {
+  sBlocks = sBlocks + 1;
+  if (cycles < sBlockMin) sBlockMin = cycles;
+  if (cycles > sBlockMax) sBlockMax = cycles;
+  uint32_t b = cycles / sBucketCycles;
+  if (b >= (uint32_t)kMetricsBuckets) b = kMetricsBuckets - 1;
+  sHist[b] = sHist[b] + 1;
+}
+
+void Metrics::voiceStolen() {
+  sSteals = sSteals + 1;
+}
+
+void Metrics::loopPass(uint32_t cycles) {
+  if (cycles > sLoopMax) sLoopMax = cycles;
+  sLoopSum += cycles;
+  sLoopCount++;
+}
+
+void Metrics::midiMessage() {
+  sMidiCount++;
+}
+
+void Metrics::looperLate(uint32_t samples) {
+  if (samples > sLateMax) sLateMax = samples;
+}
+
+// --- Reports ---------------------------------------------------
+
+void Metrics::read(uint32_t* f) {
+  __disable_irq();
+  f[METRIC_BLOCKS]    = sBlocks;
+  f[METRIC_BLOCK_MIN] = sBlocks ? sBlockMin : 0;
+  f[METRIC_BLOCK_MAX] = sBlockMax;
+  f[METRIC_STEALS]    = sSteals;
+  for (int b = 0; b < kMetricsBuckets; b++) f[METRIC_HIST + b] = sHist[b];
+  __enable_irq();
+
+  f[METRIC_BLOCK_PERIOD]       = sBlockPeriod;
+  f[METRIC_CPU_MAX]            = (uint32_t)(AudioProcessorUsageMax() * 100.0f + 0.5f);
+  f[METRIC_MEM_MAX]            = (uint32_t)AudioMemoryUsageMax();
+  f[METRIC_LOOP_MAX_US]        = cyclesToUs(sLoopMax);
+  f[METRIC_LOOP_MEAN_US]       = sLoopCount ? cyclesToUs(sLoopSum / sLoopCount) : 0;
+  f[METRIC_MIDI_PER_S]         = sMidiRate;
+  f[METRIC_LOOPER_LATE_MAX_US] = (uint32_t)((uint64_t)sLateMax * 1000000 / (uint32_t)AUDIO_SAMPLE_RATE_EXACT);
+}
+
+void Metrics::reset() {
+  __disable_irq();
+  sBlocks   = 0;
+  sBlockMin = 0xFFFFFFFFu;
+  sBlockMax = 0;
+  sSteals   = 0;
+  for (int b = 0; b < kMetricsBuckets; b++) sHist[b] = 0;
+  __enable_irq();
+
+  AudioProcessorUsageMaxReset();
+  AudioMemoryUsageMaxReset();
+  sLoopMax   = 0;
+  sLoopSum   = 0;
+  sLoopCount = 0;
+  sLateMax   = 0;
+}
+
+static void sendSysExReport() {
+  uint32_t f[METRIC_FIELDS];
+  Metrics::read(f);
+
+  uint8_t msg[6 + METRIC_FIELDS * 5];
+  int n = 0;
+  msg[n++] = 0xF0;
+  msg[n++] = kSysExMfrId;
+  msg[n++] = kSysExMetrics;
+  msg[n++] = 0x02;
+  msg[n++] = Metrics::kVersion;
+  for (uint32_t v : f) {
+    for (int i = 0; i < 5; i++, v >>= 7) msg[n++] = v & 0x7F;
+  }
+  msg[n++] = 0xF7;
+  usbMIDI.sendSysEx(n, msg, true);
+}
+
+void Metrics::onSysEx(const uint8_t* data, uint16_t len) {
+  if (len < 5 || data[0] != 0xF0 || data[1] != kSysExMfrId || data[2] != kSysExMetrics) return;
+  if (data[3] == 0x01) sendSysExReport();
+  if (data[3] == 0x03) reset();
+}
+
+void Metrics::report(Print& out) {
+  uint32_t f[METRIC_FIELDS];
+  read(f);
+  uint32_t period = f[METRIC_BLOCK_PERIOD];
+
+  out.print("[METRICS] audio: ");
+  out.print(f[METRIC_BLOCKS]);
+  out.print(" blocks, ");
+  out.print(f[METRIC_BLOCK_MIN] * 100 / period);
+  out.print("-");
+  out.print(f[METRIC_BLOCK_MAX] * 100 / period);
+  out.print("% of a block, usage max ");
+  out.print(f[METRIC_CPU_MAX] / 100.0f);
+  out.print("%, memory max ");
+  out.print(f[METRIC_MEM_MAX]);
+  out.println(" blocks");
+
+  out.print("[METRICS] load histogram (1/");
+  out.print(kMetricsBuckets);
+  out.print(" block):");
+  for (int b = 0; b < kMetricsBuckets; b++) {
+    out.print(" ");
+    out.print(f[METRIC_HIST + b]);
+  }
+  out.println();
+
+  out.print("[METRICS] loop: max ");
+  out.print(f[METRIC_LOOP_MAX_US]);
+  out.print(" us, mean ");
+  out.print(f[METRIC_LOOP_MEAN_US]);
+  out.print(" us; MIDI ");
+  out.print(f[METRIC_MIDI_PER_S]);
+  out.print(" msg/s; steals ");
+  out.print(f[METRIC_STEALS]);
+  out.print("; looper late max ");
+  out.print(f[METRIC_LOOPER_LATE_MAX_US]);
+  out.println(" us");
+}
+
+void Metrics::poll() {
+  uint32_t now = millis();
+  if (now - sMidiSecond >= 1000) {
+    sMidiRate   = sMidiCount;
+    sMidiCount  = 0;
+    sMidiSecond = now;
+  }
+
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == '?') report(Log);
+    if (c == 'r') {
+      reset();
+      Log.println("[METRICS] Reset");
+    }
+  }
+}
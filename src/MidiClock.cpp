@@ -0,0 +1,285 @@
+// ============================================================
+// MidiClock.cpp -- Clock fit (slave) and pulse scheduling (master)
+//
+// The fit is recomputed on every pulse from the ring of the last
+// kClockFitPulses (index, time) pairs, relative to the newest
+// pulse so the sums stay small.  A Start or Continue renumbers
+// the ring and the fit instead of dropping them, so the tempo
+// carries over.
+//
+// Master pulse n is due at origin + n * beat / 24, computed from
+// the origin each time, so the pulses never drift from the loop.
+// Resuming after a stop, the first pulse sent is the next whole
+// sixteenth (6 pulses), which is all a Song Position can name.
+// ============================================================
+
+#include "MidiClock.h"
+#include "AudioClock.h"
+#include "Log.h"
+#include <Audio.h>
+#include <math.h>
+
+using MidiClock::kPulsesPerBeat;
+
+static constexpr uint32_t kMinFit        = 6;    // pulses before the fit is trusted
+static constexpr uint32_t kTimeout       = (uint32_t)(AUDIO_SAMPLE_RATE_EXACT / 4);   // 250 ms
+static constexpr uint32_t kPulsesPerStep = 6;    // one Song Position unit (a sixteenth)
+
+static ClockMode sMode = CLOCK_INTERNAL;
+
+// --- Slave -----------------------------------------------------
+
+struct Pulse {
+  uint32_t index;
+  uint32_t time;
+};
+
+/// time(n) = refTime + (n - refIndex) * period.  Read by the ISR.
+struct Fit {
+  uint32_t refTime;
+  uint32_t refIndex;
+  double   period;     // samples per pulse
+};
+
+static Pulse         sRing[kClockFitPulses];
+static uint32_t      sCount    = 0;       // pulses in the ring
+static uint32_t      sHead     = 0;       // next ring slot
+static uint32_t      sNext     = 0;       // index of the next pulse
+static uint32_t      sSongPos  = 0;       // pulse a Continue resumes from
+static uint32_t      sStart    = 0;       // pulse the transport started on
+static bool          sDownbeat = false;   // Start/Continue seen, sStart not yet
+static volatile bool sRunning  = false;
+static Fit           sFit      = { 0, 0, 0.0 };
+
+static const Pulse& newest() {
+  return sRing[(sHead + kClockFitPulses - 1) % kClockFitPulses];
+}
+
+/// Least-squares line through the pulses in the ring.
+static void refit() {
+  const Pulse& last = newest();
+  double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+  for (uint32_t i = 0; i < sCount; i++) {
+    const Pulse& p = sRing[(sHead + kClockFitPulses - 1 - i) % kClockFitPulses];
+    double x = (int32_t)(p.index - last.index);
+    double y = (int32_t)(p.time - last.time);
+    sx  += x;
+    sy  += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  double n   = sCount;
+  double den = n * sxx - sx * sx;
+  if (den <= 0.0) return;
+  double period = (n * sxy - sx * sy) / den;
+  if (period <= 0.0) return;
+  double at = (sy - period * sx) / n;       // fitted time of the newest pulse
+
+  Fit f = { last.time + (uint32_t)lround(at), last.index, period };
+  __disable_irq();
+  sFit = f;
+  __enable_irq();
+}
+
+bool MidiClock::onPulse() {
+  if (sMode != CLOCK_SLAVE) return false;
+  uint32_t now = AudioClock::now();
+
+  // Pulses from before a gap say nothing about the tempo now
+  if (sCount > 0 && now - newest().time > kTimeout) {
+    sCount   = 0;
+    sRunning = false;
+  }
+
+  uint32_t index = sNext++;
+  sRing[sHead] = { index, now };
+  sHead = (sHead + 1) % kClockFitPulses;
+  if (sCount < kClockFitPulses) sCount++;
+
+  if (sCount >= kMinFit) {
+    refit();
+    if (!sRunning) {
+      sRunning = true;
+      Log.print("[CLOCK] Following external clock: ");
+      Log.print(60.0 * AUDIO_SAMPLE_RATE_EXACT / (sFit.period * kPulsesPerBeat), 1);
+      Log.println(" BPM");
+    }
+  }
+
+  bool downbeat = sDownbeat && index == sStart;
+  sDownbeat = false;
+  return downbeat;
+}
+
+/// Renumber the ring and the fit so the next pulse is `next`.
+static void renumber(uint32_t next) {
+  uint32_t shift = sNext - next;
+  for (uint32_t i = 0; i < kClockFitPulses; i++) sRing[i].index -= shift;
+  __disable_irq();
+  sFit.refIndex -= shift;
+  __enable_irq();
+  sNext = next;
+}
+
+void MidiClock::onStart() {
+  if (sMode != CLOCK_SLAVE) return;
+  Log.println("[CLOCK] Start");
+  renumber(0);
+  sSongPos  = 0;
+  sStart    = 0;
+  sDownbeat = true;
+}
+
+void MidiClock::onContinue() {
+  if (sMode != CLOCK_SLAVE) return;
+  Log.print("[CLOCK] Continue at pulse ");
+  Log.println(sSongPos);
+  renumber(sSongPos);
+  sStart    = sSongPos;
+  sDownbeat = true;
+}
+
+void MidiClock::onSongPosition(uint16_t sixteenths) {
+  if (sMode != CLOCK_SLAVE) return;
+  sSongPos = (uint32_t)sixteenths * kPulsesPerStep;
+}
+
+bool MidiClock::onStop() {
+  if (sMode != CLOCK_SLAVE) return false;
+  Log.println("[CLOCK] Stop");
+  sSongPos = sNext;           // pulses while stopped don't move the song
+  return true;
+}
+
+uint32_t MidiClock::startPulse() {
+  return sStart;
+}
+
+bool MidiClock::running() {
+  return sMode == CLOCK_SLAVE && sRunning;
+}
+
+uint32_t MidiClock::beat() {
+  return running() ? (uint32_t)lround(sFit.period * kPulsesPerBeat) : 0;
+}
+
+uint32_t MidiClock::pulseTime(uint32_t index) {
+  Fit f = sFit;
+  return f.refTime + (uint32_t)lround((int32_t)(index - f.refIndex) * f.period);
+}
+
+uint32_t MidiClock::nearestBeat(uint32_t time) {
+  Fit f = sFit;
+  if (f.period <= 0.0) return 0;
+  double n = (int32_t)f.refIndex + (int32_t)(time - f.refTime) / f.period;
+  return (uint32_t)((int32_t)floor(n / kPulsesPerBeat + 0.5) * (int32_t)kPulsesPerBeat);
+}
+
+uint32_t MidiClock::lastPulse() {
+  return newest().time;
+}
+
+// --- Master ----------------------------------------------------
+
+static uint32_t sOrigin     = 0;      // time of master pulse 0
+static uint32_t sMasterBeat = 0;
+static uint32_t sPulse      = 0;      // next pulse to send
+static bool     sSendStart  = false;
+static bool     sStopped    = false;  // Stop sent: resume with Continue
+
+static uint32_t defaultBeat() {
+  return (uint32_t)(AUDIO_SAMPLE_RATE_EXACT * 60.0f / kClockMasterBpm);
+}
+
+static uint32_t masterPulseTime(uint32_t n) {
+  return sOrigin + (uint32_t)((uint64_t)n * sMasterBeat / kPulsesPerBeat);
+}
+
+void MidiClock::loopStarted(uint32_t start, uint32_t beat) {
+  if (sMode != CLOCK_MASTER) return;
+  sOrigin     = start;
+  sMasterBeat = beat ? beat : defaultBeat();
+  sPulse      = 0;
+  sSendStart  = true;
+
+  // Resuming into a cycle already under way: from the next sixteenth
+  int32_t  late   = (int32_t)(AudioClock::now() - start);
+  uint32_t passed = late > 0 ? (uint32_t)((uint64_t)late * kPulsesPerBeat / sMasterBeat) : 0;
+  if (sStopped && passed > 0) sPulse = (passed / kPulsesPerStep + 1) * kPulsesPerStep;
+
+  Log.print("[CLOCK] Master: ");
+  Log.print(60.0f * AUDIO_SAMPLE_RATE_EXACT / sMasterBeat, 1);
+  Log.println(" BPM");
+}
+
+void MidiClock::loopStopped() {
+  if (sMode != CLOCK_MASTER) return;
+  sSendStart = false;
+  sStopped   = true;
+  usbMIDI.sendRealTime(usbMIDI.Stop);
+  usbMIDI.send_now();
+}
+
+void MidiClock::poll() {
+  uint32_t now = AudioClock::now();
+
+  if (sRunning && now - newest().time > kTimeout) {
+    sRunning = false;
+    Log.println("[CLOCK] External clock lost");
+  }
+
+  if (sMode != CLOCK_MASTER) return;
+  if ((int32_t)(now - masterPulseTime(sPulse)) < 0) return;
+
+  if (sSendStart) {
+    if (sStopped) {
+      usbMIDI.sendSongPosition((uint16_t)(sPulse / kPulsesPerStep));
+      usbMIDI.sendRealTime(usbMIDI.Continue);
+    } else {
+      usbMIDI.sendRealTime(usbMIDI.Start);
+    }
+    sSendStart = false;
+    sStopped   = false;
+  }
+  // Every pulse that is due, even after a stall: the receiver counts
+  // them, so a skipped one would put it behind the loop for good
+  while ((int32_t)(now - masterPulseTime(sPulse)) >= 0) {
+    usbMIDI.sendRealTime(usbMIDI.Clock);
+    sPulse++;
+  }
+  usbMIDI.send_now();
+}
+
+// --- Mode ------------------------------------------------------
+
+static const char* modeName(ClockMode mode) {
+  switch (mode) {
+    case CLOCK_SLAVE:  return "SLAVE";
+    case CLOCK_MASTER: return "MASTER";
+    default:           return "INTERNAL";
+  }
+}
+
+void MidiClock::setMode(ClockMode mode) {
+  if (mode == sMode) return;
+  sMode    = mode;
+  sRunning = false;
+  sCount   = 0;
+  if (mode == CLOCK_MASTER) {
+    sOrigin     = AudioClock::now();
+    sMasterBeat = defaultBeat();
+    sPulse      = 0;
+    sSendStart  = false;
+    sStopped    = false;
+  }
+  Log.print("[CLOCK] Mode: ");
+  Log.println(modeName(mode));
+}
+
+ClockMode MidiClock::mode() {
+  return sMode;
+}
+
+void MidiClock::begin() {
+  setMode(kClockModeDefault);
+}
@@ -3,61 +3,217 @@
 //
 // Routes each incoming MIDI message to the appropriate target:
 //
-//   NoteOn / NoteOff   → live synth always
-//                      → looper (if recording, via Looper class)
-//   ProgramChange      → live synth preset + looper preset tracking
-//   ControlChange      → both synths (volume, echo parameters)
+//   NoteOn / NoteOff   → the channel's part of the synth, always
+//   ProgramChange      → channel part preset + looper preset tracking
+//                        (on kLoopSceneChannel: looper scene)
+//   PitchBend          → channel part pitch (block-rate ratio)
+//   ChannelPressure    → channel part gain / pad brightness
+//   ControlChange      → ParamMap lookup → synth setters
+//   Clock / Start / Continue / Stop / SongPosition
+//                      → MidiClock, then the looper's transport
 //
-// Uses the CC constants from config.h rather than magic numbers.
+// Each of these is also handed to the looper, which stores it
+// while recording (via the Looper class).
+//
+// CC numbers are not hard-wired here: ParamMap owns the table
+// (defaults from config.h, remappable via MIDI learn).  CC 0..31
+// pair with an LSB on CC 32..63, and NRPN data entry addresses
+// parameters directly, both at 14-bit resolution.
 // ============================================================
 
 #include "MidiHandler.h"
 #include "MyDsp.h"
 #include "Looper.h"
+#include "ParamMap.h"
+#include "LoopStore.h"
+#include "MidiClock.h"
+#include "Log.h"
+#include "Metrics.h"
 #include "config.h"
 #include <Arduino.h>
 
 // File-static pointers set by begin().  This avoids globals
 // while keeping the API simple (no need to pass objects every call).
-static MyDsp*  sLive   = nullptr;
-static MyDsp*  sLooper = nullptr;
-static Looper* sLoop   = nullptr;
+static MyDsp*  sSynth = nullptr;
+static Looper* sLoop  = nullptr;
+
+// --- High-resolution controller state --------------------------
+// Kept per MIDI channel so interleaved controllers on different
+// channels never mix up each other's MSB/LSB halves.  Every
+// message is applied as soon as it arrives: an MSB is used on
+// its own and refined when (if) the matching LSB follows.
+
+struct ChannelCcState {
+  uint8_t msb[32] = {};     // last MSB received on CC 0..31
+  uint8_t nrpnMsb = 0x7F;   // selected NRPN (0x7F/0x7F = none)
+  uint8_t nrpnLsb = 0x7F;
+  uint8_t dataMsb = 0;      // last Data Entry MSB
+};
+
+static ChannelCcState sCcState[16];
+static uint8_t        sPreset[16];   // last preset per channel part
+
+/// Widen a 7-bit value to 14 bits so that 127 alone still reaches
+/// full scale (0x7F -> 0x3FFF) when no LSB follows.
+static inline uint16_t widen7(uint8_t v) {
+  return (uint16_t)((v << 7) | v);
+}
+
+/// Convert a 14-bit controller value (0..16383) to a float in [0, 1].
+static inline float hiresTo01(uint16_t v14) {
+  return (float)v14 / 16383.0f;
+}
+
+// --- Shared actions --------------------------------------------
+// Also used by the control panel, so a key does exactly what the
+// matching MIDI message would.
+
+void MidiHandler::applyParam(uint8_t part, uint8_t id, float x01) {
+  const ParamDesc& d = ParamMap::desc(id);
+  float v = ParamMap::scale(d, x01);
+  if (d.targets & TARGET_GLOBAL) d.apply(*sSynth, part, v);
+  if (d.targets & TARGET_LIVE)   d.apply(*sSynth, part, v);
+  if (d.targets & TARGET_LOOPER) d.apply(*sSynth, PART_LOOP, v);
+  if (d.targets & TARGET_RECORD) sLoop->recordParam(id, x01);   // no-op if not recording
+}
+
+void MidiHandler::programChange(uint8_t part, uint8_t program) {
+  int preset = program % 4;   // wrap to 0..3
+
+  sPreset[part & 0x0F] = preset;
+  sSynth->setPreset(part, preset);
+  sLoop->setLivePreset(preset);
+  sLoop->recordProgram(preset);
+
+  Log.print("[MIDI] Program Change -> preset: ");
+  Log.println(preset);
+}
 
-/// Convert a 7-bit MIDI CC value (0..127) to a float in [0, 1].
-static inline float ccTo01(uint8_t v) {
-  return (float)v / 127.0f;
+int MidiHandler::preset(uint8_t part) {
+  return sPreset[part & 0x0F];
+}
+
+// --- Control Change decoding -----------------------------------
+
+/// Parameter addressed by the channel's selected NRPN, or PARAM_NONE.
+static uint8_t nrpnParam(const ChannelCcState& st) {
+  if (st.nrpnMsb != kNrpnParamMsb || st.nrpnLsb >= PARAM_COUNT) return PARAM_NONE;
+  return st.nrpnLsb;
+}
+
+/// CC_LOOP_SPEED value -> Q16.16 rate: 64 = 1x, one octave per 32
+/// steps (32 = 1/2x, 96 = 2x, 0 = 1/4x).
+static uint32_t rateForCc(uint8_t val) {
+  return (uint32_t)(powf(2.0f, (val - 64) / 32.0f) * (1u << kLoopRateShift) + 0.5f);
+}
+
+/// Decode one Control Change: protocol CCs (learn, NRPN, data
+/// entry) first, then the ParamMap table, then 14-bit LSBs.
+static void handleControlChange(uint8_t ch, uint8_t cc, uint8_t val) {
+  ChannelCcState& st = sCcState[ch & 0x0F];
+
+  switch (cc) {
+    case CC_MIDI_LEARN:
+      ParamMap::armLearn(val);
+      return;
+
+    case CC_LOOP_GRID:      if (val) sLoop->quantiseLoop(val / 127.0f); return;
+    case CC_LOOP_HUMANISE:  if (val) sLoop->humaniseLoop(val / 127.0f); return;
+    case CC_LOOP_TRANSPOSE: if (val != 64) sLoop->transposeLoop(val - 64); return;
+    case CC_LOOP_VELOCITY:  if (val != 64) sLoop->scaleVelocity(val / 64.0f); return;
+    case CC_LOOP_COMPRESS:  if (val) sLoop->compressVelocity(val / 127.0f); return;
+
+    case CC_LOOP_SPEED:    sLoop->setRate(rateForCc(val)); return;
+    case CC_LOOP_REVERSE:  sLoop->setReverse(val >= 64); return;
+    case CC_CLOCK_MODE:    MidiClock::setMode((ClockMode)(val * 3 / 128)); return;
+    case CC_LOOP_QUANTISE: sLoop->setQuantise(val >= 64); return;
+    case CC_LOOP_SAVE:     if (val >= 64) LoopStore::save(); return;
+    case CC_LOOP_LOAD:     if (val >= 64) LoopStore::load(); return;
+    case CC_LOOP_UNDO:     if (val >= 64) sLoop->undo(); return;
+    case CC_LOOP_REDO:     if (val >= 64) sLoop->redo(); return;
+
+    case CC_NRPN_MSB: st.nrpnMsb = val; return;
+    case CC_NRPN_LSB: st.nrpnLsb = val; return;
+
+    case CC_RPN_MSB:
+    case CC_RPN_LSB:
+      // RPNs are not implemented: deselect so data entry is ignored.
+      st.nrpnMsb = 0x7F;
+      st.nrpnLsb = 0x7F;
+      return;
+
+    case CC_DATA_ENTRY_MSB: {
+      st.dataMsb = val;
+      uint8_t id = nrpnParam(st);
+      if (id != PARAM_NONE) MidiHandler::applyParam(ch, id, hiresTo01(widen7(val)));
+      return;
+    }
+
+    case CC_DATA_ENTRY_LSB: {
+      uint8_t id = nrpnParam(st);
+      if (id != PARAM_NONE) MidiHandler::applyParam(ch, id, hiresTo01((uint16_t)((st.dataMsb << 7) | val)));
+      return;
+    }
+
+    default:
+      break;
+  }
+
+  if (ParamMap::learning()) {
+    ParamMap::learn(cc);   // bind, then apply the value below
+  }
+
+  if (cc < 32) st.msb[cc] = val;
+
+  uint8_t id = ParamMap::paramForCc(cc);
+  if (id != PARAM_NONE) {
+    MidiHandler::applyParam(ch, id, hiresTo01(widen7(val)));
+    return;
+  }
+
+  // An unbound CC 32..63 is the LSB of the controller 32 below it.
+  if (cc >= 32 && cc < 64) {
+    uint8_t msbCc = cc - 32;
+    id = ParamMap::paramForCc(msbCc);
+    if (id != PARAM_NONE) {
+      MidiHandler::applyParam(ch, id, hiresTo01((uint16_t)((st.msb[msbCc] << 7) | val)));
+    }
+  }
 }
 
 // --- Public API ------------------------------------------------
 
-void MidiHandler::begin(MyDsp& liveSynth, MyDsp& looperSynth, Looper& looper) {
-  sLive   = &liveSynth;
-  sLooper = &looperSynth;
-  sLoop   = &looper;
+void MidiHandler::begin(MyDsp& synth, Looper& looper) {
+  sSynth = &synth;
+  sLoop  = &looper;
 
+  ParamMap::begin();
   usbMIDI.begin();
   Serial.println("[MIDI] USB MIDI started");
 }
 
 void MidiHandler::process() {
   uint8_t type = usbMIDI.getType();
+  uint8_t ch   = (usbMIDI.getChannel() - 1) & 0x0F;   // 1..16 -> part 0..15
+
+  Metrics::midiMessage();
 
   // ---- NoteOn -------------------------------------------------
   if (type == usbMIDI.NoteOn) {
     uint8_t note = usbMIDI.getData1();
     uint8_t vel  = usbMIDI.getData2();
 
-    Serial.print("[MIDI] NoteON: note=");
-    Serial.print(note);
-    Serial.print(" vel=");
-    Serial.println(vel);
+    Log.print("[MIDI] NoteON: note=");
+    Log.print(note);
+    Log.print(" vel=");
+    Log.println(vel);
 
     if (vel > 0) {
-      sLive->noteOn(note, vel);
+      sSynth->noteOn(ch, note, vel);
       sLoop->recordNoteOn(note, vel);   // no-op if not recording
     } else {
       // NoteOn with velocity 0 is equivalent to NoteOff (MIDI spec)
-      sLive->noteOff(note);
+      sSynth->noteOff(ch, note);
       sLoop->recordNoteOff(note);
     }
   }
@@ -66,57 +222,66 @@ void MidiHandler::process() {
   else if (type == usbMIDI.NoteOff) {
     uint8_t note = usbMIDI.getData1();
 
-    Serial.print("[MIDI] NoteOFF: note=");
-    Serial.println(note);
+    Log.print("[MIDI] NoteOFF: note=");
+    Log.println(note);
 
-    sLive->noteOff(note);
+    sSynth->noteOff(ch, note);
     sLoop->recordNoteOff(note);
   }
 
+  // ---- Program Change on the scene channel: loop scene -------
+  // (higher programs fall through to a preset change for that part)
+  else if (type == usbMIDI.ProgramChange && ch == kLoopSceneChannel - 1 &&
+           usbMIDI.getData1() < kLoopScenes) {
+    sLoop->selectScene(usbMIDI.getData1());
+  }
+
   // ---- Program Change -----------------------------------------
   else if (type == usbMIDI.ProgramChange) {
-    uint8_t pgm = usbMIDI.getData1();
-    int preset = pgm % 4;   // wrap to 0..3
+    programChange(ch, usbMIDI.getData1());
+  }
 
-    sLive->setPreset(preset);
-    sLoop->setLivePreset(preset);
+  // ---- Pitch Bend ---------------------------------------------
+  else if (type == usbMIDI.PitchBend) {
+    // 14-bit value, LSB in data1, MSB in data2, centre = 8192
+    uint16_t raw = (usbMIDI.getData2() << 7) | usbMIDI.getData1();
+    sSynth->setPitchBend(ch, (int)raw - 8192);
+    sLoop->recordPitchBend(raw);
+  }
 
-    Serial.print("[MIDI] Program Change -> preset: ");
-    Serial.println(preset);
+  // ---- Channel Pressure (aftertouch) --------------------------
+  else if (type == usbMIDI.AfterTouchChannel) {
+    sSynth->setPressure(ch, usbMIDI.getData1() / 127.0f);
+    sLoop->recordPressure(usbMIDI.getData1());
   }
 
   // ---- Control Change -----------------------------------------
   else if (type == usbMIDI.ControlChange) {
     uint8_t cc  = usbMIDI.getData1();
     uint8_t val = usbMIDI.getData2();
+    handleControlChange(ch, cc, val);
+  }
 
-    // Apply CC to BOTH synths (live + looper) so they share
-    // the same effect settings and volume.
+  // ---- MIDI clock and transport (see MidiClock.h) ------------
+  else if (type == usbMIDI.Clock) {
+    if (MidiClock::onPulse()) sLoop->onClockStart();
+  }
+  else if (type == usbMIDI.Start) {
+    MidiClock::onStart();
+  }
+  else if (type == usbMIDI.Continue) {
+    MidiClock::onContinue();
+  }
+  else if (type == usbMIDI.SongPosition) {
+    // 14-bit count of sixteenth notes, LSB in data1, MSB in data2
+    MidiClock::onSongPosition((usbMIDI.getData2() << 7) | usbMIDI.getData1());
+  }
+  else if (type == usbMIDI.Stop) {
+    if (MidiClock::onStop()) sLoop->onClockStop();
+  }
 
-    if (cc == CC_MASTER_VOL) {
-      float gain = ccTo01(val);
-      sLive->setMasterGain(gain);
-      sLooper->setMasterGain(gain);
-    }
-    else if (cc == CC_ECHO_ON) {
-      bool on = val >= 64;
-      sLive->setEchoOn(on);
-      sLooper->setEchoOn(on);
-    }
-    else if (cc == CC_ECHO_MIX) {
-      float mix = ccTo01(val);
-      sLive->setEchoMix(mix);
-      sLooper->setEchoMix(mix);
-    }
-    else if (cc == CC_ECHO_FB) {
-      float fb = 0.85f * ccTo01(val);   // scale to max 0.85
-      sLive->setEchoFb(fb);
-      sLooper->setEchoFb(fb);
-    }
-    else if (cc == CC_ECHO_MS) {
-      float ms = 30.0f + (770.0f * ccTo01(val));   // 30..800 ms
-      sLive->setEchoMs(ms);
-      sLooper->setEchoMs(ms);
-    }
+  // ---- SysEx: metrics requests (see Metrics.h) ---------------
+  else if (type == usbMIDI.SystemExclusive) {
+    Metrics::onSysEx(usbMIDI.getSysExArray(), usbMIDI.getSysExArrayLength());
   }
 }
@@ -1,13 +1,16 @@
 // ============================================================
 // MyDsp.cpp -- Polyphonic synthesiser engine implementation
 //
-// Generates audio sample-by-sample inside update(), which is
-// called from the Teensy Audio ISR.  Each voice runs an
-// oscillator through an ADSR envelope, and all voices are
-// summed then passed through a global echo effect.
+// Generates audio inside update(), which is called from the
+// Teensy Audio ISR.  Each active voice renders a whole block
+// into a mix bus through one shared kernel (partials + ADSR),
+// parameterised by its preset's Timbre; then the bus is passed
+// sample by sample through the global echo effect.
 // ============================================================
 
 #include "MyDsp.h"
+#include "AudioClock.h"
+#include "Metrics.h"
 #include <math.h>
 
 static constexpr int   AUDIO_OUTPUTS = 2;
@@ -16,6 +19,7 @@ static constexpr int16_t MULT_16     = 32767;
 // ---------- Static member initialisation -----------------------
 float MyDsp::sSineTable[MyDsp::kSineSize];
 bool  MyDsp::sSineInit = false;
+float MyDsp::sBendTable[MyDsp::kBendTableSize + 1];
 
 // ---------- Sine wavetable -------------------------------------
 
@@ -27,6 +31,15 @@ void MyDsp::initSineTable() {
   sSineInit = true;
 }
 
+// ---------- Pitch-bend table -----------------------------------
+
+void MyDsp::initBendTable() {
+  for (int i = 0; i <= kBendTableSize; i++) {
+    float semis = kBendRangeSemis * (2.0f * i / kBendTableSize - 1.0f);
+    sBendTable[i] = powf(2.0f, semis / 12.0f);
+  }
+}
+
 /// Look up the sine table with a normalised phase [0, 1).
 /// Uses a bitmask for safe wrapping (kSineSize must be power of 2).
 float MyDsp::sineFromPhase(float phase01) const {
@@ -34,6 +47,54 @@ float MyDsp::sineFromPhase(float phase01) const {
   return sSineTable[idx];
 }
 
+// ---------- Preset timbres --------------------------------------
+// The four presets as kernel data.  Ratios are shared literals so
+// blendTimbres() can merge equal partials of adjacent presets.
+
+static constexpr float kDetune = 0.004f;   // pad detune
+
+const MyDsp::Timbre MyDsp::kPresetTimbres[4] = {
+  // 0: pure sine
+  { 1, { 1.0f },                    { 1.0f },                       0.0f,  0.0f },
+  // 1: additive (organ/bell) — fundamental + 3 harmonics
+  { 4, { 1.0f, 2.0f, 3.0f, 1.5f },  { 1.0f, 0.50f, 0.30f, 0.20f },  0.0f,  0.0f },
+  // 2: electric — harmonics + decaying noise transient
+  { 3, { 1.0f, 2.0f, 4.0f },        { 1.0f, 0.35f, 0.15f },         0.15f, 0.0f },
+  // 3: pad — two detuned sines through the low-pass
+  { 2, { 1.0f - kDetune, 1.0f + kDetune }, { 0.6f, 0.6f },          0.0f,  1.0f },
+};
+
+/// Merge two presets' partial lists with weights (1-t) and t.
+/// Partials with equal ratios share one slot, and a side with zero
+/// weight is skipped, so at t = 0 or 1 the result costs exactly
+/// as much per sample as the plain preset.
+void MyDsp::blendTimbres(const Timbre& a, const Timbre& b, float t, Timbre& out) {
+  const float ta = 1.0f - t;
+  out.count = 0;
+  if (ta > 0.0f) {
+    for (int k = 0; k < a.count; k++) {
+      out.ratio[out.count]  = a.ratio[k];
+      out.weight[out.count] = a.weight[k] * ta;
+      out.count++;
+    }
+  }
+  if (t > 0.0f) {
+    for (int k = 0; k < b.count; k++) {
+      int j = 0;
+      while (j < out.count && out.ratio[j] != b.ratio[k]) j++;
+      if (j == out.count) {
+        if (out.count == Timbre::kMaxPartials) continue;
+        out.ratio[j]  = b.ratio[k];
+        out.weight[j] = 0.0f;
+        out.count++;
+      }
+      out.weight[j] += b.weight[k] * t;
+    }
+  }
+  out.noise = ta * a.noise + t * b.noise;
+  out.lpMix = ta * a.lpMix + t * b.lpMix;
+}
+
 // ---------- Simple PRNG for noise ------------------------------
 
 float MyDsp::fastRand01() {
@@ -49,6 +110,7 @@ MyDsp::MyDsp()
   : AudioStream(0, NULL)
 {
   initSineTable();
+  initBendTable();
 
   // Allocate the mono echo ring buffer and zero it out.
   echoBuf = new float[kMaxEchoSamples];
@@ -99,15 +161,30 @@ int MyDsp::stealVoice() const {
 // briefly to prevent data races with update() which runs in the
 // audio ISR.
 
-void MyDsp::noteOn(uint8_t note, uint8_t vel) {
+void MyDsp::noteOn(uint8_t part, uint8_t note, uint8_t vel) {
+  if (part >= kParts) return;
+  note &= 0x7F;
   __disable_irq();
 
   int idx = findFreeVoice();
-  if (idx < 0) idx = stealVoice();
+  if (idx < 0) {
+    idx = stealVoice();
+    Metrics::voiceStolen();
+  }
 
   Voice& v  = voices[idx];
+  Part&  pt = parts[part];
+  if (v.active) unlinkVoice(idx);   // stolen voice
+  noteVoices[note] |= (1u << idx);
+  partVoices[part] |= (1u << idx);
+  pt.keysDown.set(note);
+  pt.deferred.reset(note);   // re-struck: its next note-off releases it
+
   v.active   = true;
   v.note     = note;
+  v.part     = part;
+  v.preset   = pt.preset;    // latched: later program changes don't affect it
+  v.gain     = pt.gain;
   v.age      = ageCounter++;
   v.phase    = 0.0f;
   v.phaseInc = midiToFreq(note) / AUDIO_SAMPLE_RATE_EXACT;  // cache once
@@ -125,19 +202,115 @@ void MyDsp::noteOn(uint8_t note, uint8_t vel) {
   __enable_irq();
 }
 
-void MyDsp::noteOff(uint8_t note) {
+void MyDsp::noteOff(uint8_t part, uint8_t note) {
+  if (part >= kParts) return;
+  note &= 0x7F;
   __disable_irq();
-  for (int i = 0; i < kVoices; i++) {
-    if (voices[i].active && voices[i].note == note) {
+  Part& pt = parts[part];
+  pt.keysDown.reset(note);
+
+  // A pedal holding this key defers the release until it lifts.
+  if (pt.sustainDown || (pt.sostenutoDown && pt.sostenutoHeld.test(note))) {
+    pt.deferred.set(note);
+  } else {
+    NoteSet one;
+    one.set(note);
+    releaseNotes(part, one);
+  }
+  __enable_irq();
+}
+
+void MyDsp::releaseNotes(uint8_t part, NoteSet notes) {
+  const uint32_t mine = partVoices[part];
+  for (int n = notes.popLowest(); n >= 0; n = notes.popLowest()) {
+    uint32_t mask = noteVoices[n] & mine;
+    while (mask) {
+      int i = __builtin_ctz(mask);
+      mask &= mask - 1;
       voices[i].stage = RELEASE;
     }
   }
+}
+
+void MyDsp::unlinkVoice(int i) {
+  const uint32_t bit = ~(1u << i);
+  noteVoices[voices[i].note] &= bit;
+  partVoices[voices[i].part] &= bit;
+}
+
+void MyDsp::setSustain(uint8_t part, bool down) {
+  if (part >= kParts) return;
+  __disable_irq();
+  Part& pt = parts[part];
+  pt.sustainDown = down;
+  if (!down) {
+    // Release deferred notes, except those that sostenuto is
+    // still latching.
+    NoteSet rel = pt.deferred;
+    if (pt.sostenutoDown) rel = rel.minus(pt.sostenutoHeld);
+    pt.deferred = pt.deferred.minus(rel);
+    releaseNotes(part, rel);
+  }
+  __enable_irq();
+}
+
+void MyDsp::setSostenuto(uint8_t part, bool down) {
+  if (part >= kParts) return;
+  __disable_irq();
+  Part& pt = parts[part];
+  if (down && !pt.sostenutoDown) {
+    pt.sostenutoHeld = pt.keysDown;   // latch only keys held right now
+  } else if (!down) {
+    pt.sostenutoHeld.clear();
+    if (!pt.sustainDown) {
+      releaseNotes(part, pt.deferred);
+      pt.deferred.clear();
+    }
+  }
+  pt.sostenutoDown = down;
+  __enable_irq();
+}
+
+/// Map the 14-bit bend onto the ratio table with linear
+/// interpolation between its 129 entries (128 bend units apart).
+void MyDsp::setPitchBend(uint8_t part, int bend) {
+  if (part >= kParts) return;
+  int u = bend + 8192;                    // 0..16383
+  u = (u < 0) ? 0 : (u > 16383) ? 16383 : u;
+  int   idx  = u >> 7;
+  float frac = (float)(u & 0x7F) * (1.0f / 128.0f);
+  float r = sBendTable[idx] + frac * (sBendTable[idx + 1] - sBendTable[idx]);
+
+  __disable_irq();
+  parts[part].bendRatio = r;
+  __enable_irq();
+}
+
+void MyDsp::setPressure(uint8_t part, float p) {
+  if (part >= kParts) return;
+  __disable_irq();
+  parts[part].pressure = clampf(p, 0.0f, 1.0f);
   __enable_irq();
 }
 
-void MyDsp::setPreset(int p) {
+void MyDsp::setPreset(uint8_t part, int p) {
+  if (part >= kParts) return;
   __disable_irq();
-  preset = (p < 0) ? 0 : (p > 3) ? 3 : p;
+  parts[part].preset = (p < 0) ? 0 : (p > 3) ? 3 : p;
+  __enable_irq();
+}
+
+void MyDsp::setMorph(uint8_t part, float m) {
+  if (part >= kParts) return;
+  __disable_irq();
+  parts[part].morph = clampf(m, 0.0f, 1.0f);
+  __enable_irq();
+}
+
+void MyDsp::setPartGain(uint8_t part, float g) {
+  if (part >= kParts) return;
+  __disable_irq();
+  parts[part].gain = clampf(g, 0.0f, 1.0f);
   __enable_irq();
 }
 
@@ -172,6 +345,12 @@ void MyDsp::setEchoMs(float ms) {
   __enable_irq();
 }
 
+void MyDsp::setBlockCallback(BlockCallback cb) {
+  __disable_irq();
+  blockCallback = cb;
+  __enable_irq();
+}
+
 void MyDsp::allNotesOff() {
   __disable_irq();
   for (int i = 0; i < kVoices; i++) {
@@ -181,6 +360,13 @@ void MyDsp::allNotesOff() {
       voices[i].active = false;
     }
   }
+  for (int n = 0; n < 128; n++) noteVoices[n] = 0;
+  for (int p = 0; p < kParts; p++) {
+    partVoices[p] = 0;
+    parts[p].keysDown.clear();
+    parts[p].sostenutoHeld.clear();
+    parts[p].deferred.clear();
+  }
   __enable_irq();
 }
 
@@ -214,121 +400,169 @@ float MyDsp::processEcho(float x) {
   return y;
 }
 
+// ---------- Voice kernels (ISR context) ------------------------
+
+/// Advance one voice's ADSR by one sample.  Returns false (and
+/// deactivates the voice) once the release has finished.
+inline bool MyDsp::stepEnvelope(Voice& voice, const EnvRates& r) {
+  switch (voice.stage) {
+    case ATTACK:
+      voice.env += r.atk;
+      if (voice.env >= 1.0f) { voice.env = 1.0f; voice.stage = DECAY; }
+      break;
+
+    case DECAY:
+      voice.env -= r.dec;
+      if (voice.env <= susL) { voice.env = susL; voice.stage = SUSTAIN; }
+      break;
+
+    case SUSTAIN:
+      break;   // hold at sustain level
+
+    case RELEASE:
+      voice.env -= r.rel;
+      if (voice.env <= 0.0f) {
+        voice.env    = 0.0f;
+        voice.stage  = OFF;
+        voice.active = false;
+      }
+      break;
+
+    case OFF:
+    default:
+      voice.active = false;
+      break;
+  }
+  return voice.active;
+}
+
+/// Render `n` samples of one voice into `mix`.  Every preset runs
+/// through this one kernel; `tb` (resolved once per segment) decides
+/// which partials, noise and filtering it produces.  Returns false
+/// if the voice finished during the block.
+bool MyDsp::renderVoice(Voice& voice, const Timbre& tb, float* mix, int n,
+                        float inc, float amp, const EnvRates& r) {
+  const int   count = tb.count;
+  const float noise = tb.noise;
+  const float lpMix = tb.lpMix;
+
+  for (int i = 0; i < n; i++) {
+    if (!stepEnvelope(voice, r)) return false;
+
+    // --- Oscillator phase advance ---
+    // phaseInc was cached in noteOn() to avoid calling powf() every
+    // sample; `inc` applies the part's current pitch bend.
+    voice.phase += inc;
+    if (voice.phase >= 1.0f) voice.phase -= 1.0f;
+    const float p = voice.phase;
+
+    // --- Partials ---
+    // sineFromPhase() wraps with a bitmask, so p * ratio needs no fmodf().
+    float s = 0.0f;
+    for (int k = 0; k < count; k++) {
+      s += tb.weight[k] * sineFromPhase(p * tb.ratio[k]);
+    }
+
+    // --- Decaying noise transient ("electric") ---
+    if (noise > 0.0f) {
+      voice.transient *= 0.9992f;   // fast exponential decay
+      s += (fastRand01() * 2.0f - 1.0f) * noise * voice.transient;
+    }
+
+    // --- Low-pass ("pad"), crossfaded by lpMix while morphing ---
+    if (lpMix > 0.0f) {
+      float f = voice.lp.tick(s);
+      s += lpMix * (f - s);
+    }
+
+    // Apply per-voice envelope, velocity, part gain and pressure
+    mix[i] += s * voice.env * amp;
+  }
+  return true;
+}
+
 // ---------- Audio block generation (ISR context) ---------------
 
+/// Render every active voice from the current render position up
+/// to sample `end` of the block.  update() calls it once for the
+/// whole block; a block callback may call it first at each event
+/// offset so that the event it applies next lands on that sample.
+void MyDsp::renderTo(int end) {
+  if (end > AUDIO_BLOCK_SAMPLES) end = AUDIO_BLOCK_SAMPLES;
+  if (end <= renderPos) return;
+
+  float*    mix = mixBus + renderPos;
+  const int n   = end - renderPos;
+
+  for (int v = 0; v < kVoices; v++) {
+    Voice& voice = voices[v];
+    if (!voice.active) continue;
+
+    // Control-rate modulation, resolved from the voice's part:
+    // bend scales the cached increment, pressure adds gain and
+    // opens the pad filter.  Nothing here is re-evaluated per sample.
+    const Part& pt  = parts[voice.part];
+    const float inc = voice.phaseInc * pt.bendRatio;
+    const float amp = voice.vel * voice.gain * (1.0f + kPressureGain * pt.pressure);
+    voice.lp.a = 0.12f + kPressureBright * pt.pressure;
+
+    // Resolve the timbre once per voice per segment: the latched
+    // preset, morphed toward the next one by the part's control.
+    Timbre tb;
+    blendTimbres(kPresetTimbres[voice.preset & 3],
+                 kPresetTimbres[(voice.preset + 1) & 3], pt.morph, tb);
+
+    if (!renderVoice(voice, tb, mix, n, inc, amp, blockRates)) {
+      unlinkVoice(v);
+    }
+  }
+  renderPos = end;
+}
+
+// Normalisation factor so chords don't clip: 1/sqrt(kVoices)
+// keeps perceived loudness roughly constant at full polyphony.
+// Set once at static init, so the ISR only multiplies.
+static const float invVoices = 1.0f / sqrtf((float)kVoices);
+
 void MyDsp::update(void) {
+  uint32_t startCycles = ARM_DWT_CYCCNT;
+
   // Allocate two output blocks (left + right).
   // If the second allocation fails, release the first to avoid leaking.
+  // The sample clock advances even then, so time never stalls.
   audio_block_t* outBlock[AUDIO_OUTPUTS];
   outBlock[0] = allocate();
-  if (!outBlock[0]) return;
+  if (!outBlock[0]) {
+    AudioClock::advance(AUDIO_BLOCK_SAMPLES);
+    return;
+  }
   outBlock[1] = allocate();
   if (!outBlock[1]) {
     release(outBlock[0]);
+    AudioClock::advance(AUDIO_BLOCK_SAMPLES);
     return;
   }
 
   const float sr = AUDIO_SAMPLE_RATE_EXACT;
 
-  // Normalisation factor so chords don't clip.
-  // Using 1/sqrt(N) keeps perceived loudness roughly constant.
-  static constexpr float invVoices = 1.0f / 2.828427f;  // 1/sqrt(8)
-
   // Pre-compute ADSR envelope increments (per sample).
-  const float atkInc = (atkS <= 0.0001f) ? 1.0f : (1.0f / (atkS * sr));
-  const float decInc = (decS <= 0.0001f) ? 1.0f : ((1.0f - susL) / (decS * sr));
-  const float relInc = (relS <= 0.0001f) ? 1.0f : (1.0f / (relS * sr));
+  blockRates.atk = (atkS <= 0.0001f) ? 1.0f : (1.0f / (atkS * sr));
+  blockRates.dec = (decS <= 0.0001f) ? 1.0f : ((1.0f - susL) / (decS * sr));
+  blockRates.rel = (relS <= 0.0001f) ? 1.0f : (1.0f / (relS * sr));
 
-  // --- Fill the output buffer sample by sample -----------------
-  for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
-    float mix = 0.0f;
-
-    // --- Sum all active voices ---------------------------------
-    for (int v = 0; v < kVoices; v++) {
-      Voice& voice = voices[v];
-      if (!voice.active) continue;
-
-      // --- ADSR envelope step ---
-      switch (voice.stage) {
-        case ATTACK:
-          voice.env += atkInc;
-          if (voice.env >= 1.0f) { voice.env = 1.0f; voice.stage = DECAY; }
-          break;
-
-        case DECAY:
-          voice.env -= decInc;
-          if (voice.env <= susL) { voice.env = susL; voice.stage = SUSTAIN; }
-          break;
-
-        case SUSTAIN:
-          break;   // hold at sustain level
-
-        case RELEASE:
-          voice.env -= relInc;
-          if (voice.env <= 0.0f) {
-            voice.env    = 0.0f;
-            voice.stage  = OFF;
-            voice.active = false;
-          }
-          break;
-
-        case OFF:
-        default:
-          voice.active = false;
-          break;
-      }
-      if (!voice.active) continue;
-
-      // --- Oscillator phase advance ---
-      // phaseInc was cached in noteOn() to avoid calling powf() every sample.
-      voice.phase += voice.phaseInc;
-      if (voice.phase >= 1.0f) voice.phase -= 1.0f;
-
-      // --- Waveform generation (preset-dependent) ---
-      float s = 0.0f;
-
-      if (preset == 0) {
-        // Preset 0: Pure sine wave
-        s = sineFromPhase(voice.phase);
-
-      } else if (preset == 1) {
-        // Preset 1: Additive (organ/bell) — fundamental + 3 harmonics
-        float p = voice.phase;
-        float s1 = sineFromPhase(p);
-        float s2 = sineFromPhase(fmodf(p * 2.0f, 1.0f));
-        float s3 = sineFromPhase(fmodf(p * 3.0f, 1.0f));
-        float s4 = sineFromPhase(fmodf(p * 1.5f, 1.0f));
-        s = s1 + 0.50f * s2 + 0.30f * s3 + 0.20f * s4;
-
-      } else if (preset == 2) {
-        // Preset 2: Electric — harmonics + decaying noise transient
-        float p = voice.phase;
-        float base = sineFromPhase(p)
-                   + 0.35f * sineFromPhase(fmodf(p * 2.0f, 1.0f))
-                   + 0.15f * sineFromPhase(fmodf(p * 4.0f, 1.0f));
-
-        voice.transient *= 0.9992f;   // fast exponential decay
-        float noise = (fastRand01() * 2.0f - 1.0f) * 0.15f * voice.transient;
-        s = base + noise;
-
-      } else {
-        // Preset 3: Pad — two detuned sines through a low-pass filter
-        float det = 0.004f;
-        float p = voice.phase;
-        float sA = sineFromPhase(fmodf(p * (1.0f - det), 1.0f));
-        float sB = sineFromPhase(fmodf(p * (1.0f + det), 1.0f));
-        float raw = 0.6f * sA + 0.6f * sB;
-        s = voice.lp.tick(raw);
-      }
+  // --- Render voice by voice into the block mix bus ------------
+  for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) mixBus[i] = 0.0f;
+  renderPos = 0;
 
-      // Apply per-voice envelope and velocity scaling
-      s *= voice.env * voice.vel;
-      mix += s;
-    }
+  // Events scheduled inside this block (e.g. loop playback) are
+  // applied by the callback between renderTo() segments.
+  if (blockCallback) blockCallback(AudioClock::blockStart());
+  renderTo(AUDIO_BLOCK_SAMPLES);
 
-    // --- Master processing -------------------------------------
+  // --- Master processing, sample by sample ---------------------
+  for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) {
     // Normalise for polyphony, apply master gain
-    float x = mix * invVoices * masterGain;
+    float x = mixBus[i] * invVoices * masterGain;
 
     // Global echo, soft clipping, and hard safety limiter
     x = processEcho(x);
@@ -346,4 +580,7 @@ void MyDsp::update(void) {
   transmit(outBlock[1], 1);
   release(outBlock[0]);
   release(outBlock[1]);
+
+  AudioClock::advance(AUDIO_BLOCK_SAMPLES);
+  Metrics::audioBlock(ARM_DWT_CYCCNT - startCycles);
 }
@@ -0,0 +1,233 @@
+// ============================================================
+// Panel.cpp -- Gesture recogniser and binding table
+//
+// Key layout (ButtonMatrix index, row by row):
+//
+//   0 PRESET-   1 PRESET+   2 SUSTAIN   3 ECHO
+//   4 LOOP      5 UNDO      6 SCENE     7 GRID
+//   8 SAVE      9 CLOCK    10 SHIFT    11 PANIC
+//
+// SHIFT only works in combos.  Hold it and press another key for
+// that key's second function (see kBindings).
+//
+// The panel plays on kPanelPart, the part of MIDI channel 1.
+// ============================================================
+
+#include "Panel.h"
+#include "ButtonMatrix.h"
+#include "MidiHandler.h"
+#include "MidiClock.h"
+#include "LoopStore.h"
+#include "ParamMap.h"
+#include "Looper.h"
+#include "MyDsp.h"
+#include "Log.h"
+
+static MyDsp*  sSynth = nullptr;
+static Looper* sLoop  = nullptr;
+
+using Panel::Gesture;
+using Panel::GESTURE_SHORT;
+using Panel::GESTURE_LONG;
+using Panel::GESTURE_DOUBLE;
+using Panel::GESTURE_COMBO;
+
+enum PanelKey : uint8_t {
+  KEY_PRESET_DOWN = 0, KEY_PRESET_UP, KEY_SUSTAIN, KEY_ECHO,
+  KEY_LOOP,            KEY_UNDO,      KEY_SCENE,   KEY_GRID,
+  KEY_SAVE,            KEY_CLOCK,     KEY_SHIFT,   KEY_PANIC
+};
+static_assert(KEY_PANIC < kMatrixKeys, "panel layout needs a bigger matrix");
+
+// --- Actions ---------------------------------------------------
+
+static bool sSustain = false;   // panel toggles (a CC can change them too)
+static bool sEcho    = false;
+
+static void presetDown()  { MidiHandler::programChange(kPanelPart, MidiHandler::preset(kPanelPart) + 3); }
+static void presetUp()    { MidiHandler::programChange(kPanelPart, MidiHandler::preset(kPanelPart) + 1); }
+static void presetFirst() { MidiHandler::programChange(kPanelPart, 0); }
+
+static void toggleSustain() {
+  sSustain = !sSustain;
+  MidiHandler::applyParam(kPanelPart, PARAM_SUSTAIN, sSustain ? 1.0f : 0.0f);
+}
+
+static void toggleEcho() {
+  sEcho = !sEcho;
+  MidiHandler::applyParam(kPanelPart, PARAM_ECHO_ON, sEcho ? 1.0f : 0.0f);
+}
+
+/// Silence everything here and tell the gear downstream to do the same.
+static void panic() {
+  sSustain = false;
+  MidiHandler::applyParam(kPanelPart, PARAM_SUSTAIN, 0.0f);
+  sSynth->allNotesOff();
+  for (uint8_t ch = 1; ch <= 16; ch++) usbMIDI.sendControlChange(123, 0, ch);
+}
+
+static void loopButton() { sLoop->onShortPress(); }
+static void loopClear()  { sLoop->onLongPress(); }
+static void loopUndo()   { sLoop->undo(); }
+static void loopRedo()   { sLoop->redo(); }
+static void sceneNext()  { sLoop->nextScene(); }
+static void sceneFirst() { sLoop->selectScene(0); }
+static void grid()       { sLoop->quantiseLoop(1.0f); }
+static void humanise()   { sLoop->humaniseLoop(0.25f); }
+static void save()       { LoopStore::save(); }
+static void load()       { LoopStore::load(); }
+
+static void nextClockMode() {
+  MidiClock::setMode((ClockMode)((MidiClock::mode() + 1) % 3));
+}
+
+// --- Binding table ---------------------------------------------
+
+static constexpr uint8_t kNoKey = 0xFF;
+
+struct Binding {
+  uint8_t     key;
+  Gesture     gesture;
+  uint8_t     with;        // COMBO: the key being held
+  const char* name;
+  void      (*action)();
+};
+
+static const Binding kBindings[] = {
+  { KEY_PRESET_DOWN, GESTURE_SHORT,  kNoKey,    "preset -",      presetDown    },
+  { KEY_PRESET_DOWN, GESTURE_COMBO,  KEY_SHIFT, "preset 1",      presetFirst   },
+  { KEY_PRESET_UP,   GESTURE_SHORT,  kNoKey,    "preset +",      presetUp      },
+  { KEY_SUSTAIN,     GESTURE_SHORT,  kNoKey,    "sustain",       toggleSustain },
+  { KEY_ECHO,        GESTURE_SHORT,  kNoKey,    "echo",          toggleEcho    },
+  { KEY_LOOP,        GESTURE_SHORT,  kNoKey,    "loop",          loopButton    },
+  { KEY_LOOP,        GESTURE_COMBO,  KEY_SHIFT, "loop clear",    loopClear     },
+  { KEY_UNDO,        GESTURE_SHORT,  kNoKey,    "undo",          loopUndo      },
+  { KEY_UNDO,        GESTURE_DOUBLE, kNoKey,    "redo",          loopRedo      },
+  { KEY_UNDO,        GESTURE_COMBO,  KEY_SHIFT, "redo",          loopRedo      },
+  { KEY_SCENE,       GESTURE_SHORT,  kNoKey,    "next scene",    sceneNext     },
+  { KEY_SCENE,       GESTURE_LONG,   kNoKey,    "scene 1",       sceneFirst    },
+  { KEY_GRID,        GESTURE_SHORT,  kNoKey,    "grid",          grid          },
+  { KEY_GRID,        GESTURE_COMBO,  KEY_SHIFT, "humanise",      humanise      },
+  { KEY_SAVE,        GESTURE_LONG,   kNoKey,    "save loop",     save          },
+  { KEY_SAVE,        GESTURE_COMBO,  KEY_SHIFT, "load loop",     load          },
+  { KEY_CLOCK,       GESTURE_SHORT,  kNoKey,    "clock mode",    nextClockMode },
+  { KEY_PANIC,       GESTURE_SHORT,  kNoKey,    "panic",         panic         },
+};
+
+static constexpr int kBindingCount = sizeof(kBindings) / sizeof(kBindings[0]);
+static constexpr uint8_t kUnbound = 0xFF;
+
+// Binding index per key for SHORT, LONG and DOUBLE, so looking one
+// up is an array access.  Combos are rare and searched.
+static uint8_t sIndex[kMatrixKeys][GESTURE_COMBO];
+
+static void buildIndex() {
+  for (auto& row : sIndex) for (uint8_t& b : row) b = kUnbound;
+  for (int i = 0; i < kBindingCount; i++) {
+    const Binding& b = kBindings[i];
+    if (b.gesture != GESTURE_COMBO) sIndex[b.key][b.gesture] = (uint8_t)i;
+  }
+}
+
+static void fire(uint8_t index) {
+  if (index == kUnbound) return;
+  const Binding& b = kBindings[index];
+  Log.print("[PANEL] ");
+  Log.println(b.name);
+  b.action();
+}
+
+// --- Gesture recogniser ----------------------------------------
+
+struct KeyState {
+  bool     down   = false;
+  bool     used   = false;   // long, double or combo fired: the release does nothing
+  bool     tapped = false;   // released after a tap, waiting for a second one
+  uint32_t downMs = 0;
+  uint32_t upMs   = 0;
+};
+
+static KeyState sKeys[kMatrixKeys];
+
+/// A combo for `key` whose other key is held, or kUnbound.
+static uint8_t findCombo(uint8_t key) {
+  for (int i = 0; i < kBindingCount; i++) {
+    const Binding& b = kBindings[i];
+    if (b.gesture == GESTURE_COMBO && b.key == key && sKeys[b.with].down) return (uint8_t)i;
+  }
+  return kUnbound;
+}
+
+static void onPress(uint8_t key, uint32_t ms) {
+  KeyState& k = sKeys[key];
+  uint8_t combo = findCombo(key);
+
+  if (k.tapped && combo == kUnbound && ms - k.upMs <= kDoubleTapMs) {
+    k.tapped = false;
+    k.down   = true;
+    k.used   = true;
+    fire(sIndex[key][GESTURE_DOUBLE]);
+    return;
+  }
+  if (k.tapped) {                  // too late for a double: the tap was a short
+    k.tapped = false;
+    fire(sIndex[key][GESTURE_SHORT]);
+  }
+
+  k.down   = true;
+  k.used   = false;
+  k.downMs = ms;
+  if (combo != kUnbound) {
+    k.used = true;
+    sKeys[kBindings[combo].with].used = true;
+    fire(combo);
+  }
+}
+
+static void onRelease(uint8_t key, uint32_t ms) {
+  KeyState& k = sKeys[key];
+  if (!k.down) return;
+  k.down = false;
+  if (k.used) return;
+
+  if (sIndex[key][GESTURE_DOUBLE] != kUnbound) {
+    k.tapped = true;
+    k.upMs   = ms;
+  } else {
+    fire(sIndex[key][GESTURE_SHORT]);
+  }
+}
+
+/// Long presses and taps whose double-tap window has closed.
+static void fireDue(uint32_t now) {
+  for (uint8_t key = 0; key < kMatrixKeys; key++) {
+    KeyState& k = sKeys[key];
+    if (k.down && !k.used && now - k.downMs >= kPanelLongMs &&
+        sIndex[key][GESTURE_LONG] != kUnbound) {
+      k.used = true;
+      fire(sIndex[key][GESTURE_LONG]);
+    }
+    if (k.tapped && now - k.upMs > kDoubleTapMs) {
+      k.tapped = false;
+      fire(sIndex[key][GESTURE_SHORT]);
+    }
+  }
+}
+
+// --- Public API ------------------------------------------------
+
+void Panel::begin(MyDsp& synth, Looper& looper) {
+  sSynth = &synth;
+  sLoop  = &looper;
+  buildIndex();
+  ButtonMatrix::begin();
+}
+
+void Panel::poll() {
+  ButtonMatrix::Event ev;
+  while (ButtonMatrix::pop(ev)) {
+    if (ev.pressed) onPress(ev.button, ev.ms);
+    else            onRelease(ev.button, ev.ms);
+  }
+  fireDue(millis());
+}
@@ -0,0 +1,198 @@
+// ============================================================
+// ParamMap.cpp -- CC dispatch table and MIDI learn
+//
+// The descriptor table below is the single place where a synth
+// parameter is declared.  Adding a parameter means adding a
+// ParamId and one row here; MidiHandler needs no change.
+//
+// EEPROM layout at kEepromCcMapAddr:
+//   [0] 'P'  [1] 'M'  [2] kMapVersion  [3] PARAM_COUNT (when saved)
+//   [4 .. 131]  gCcToParam[0..127]
+//
+// Only kMapVersion decides whether a stored map is used: bump it
+// when this layout changes.  Adding a parameter does not, so a
+// learned map survives firmware updates; ids it does not know
+// are dropped entry by entry.  Parameters added since the map was
+// saved (id >= byte [3]) get their default CC if it is still
+// free, and the map is saved again with the new count.
+// ============================================================
+
+#include "ParamMap.h"
+#include "MyDsp.h"
+#include "Log.h"
+#include <EEPROM.h>
+#include <math.h>
+
+static constexpr uint8_t kMapVersion = 1;
+static constexpr int     kHeaderSize = 4;
+
+// --- Descriptor table ------------------------------------------
+// Captureless lambdas decay to plain function pointers, so each
+// row carries its own setter without any virtual dispatch.
+
+static const ParamDesc kParams[PARAM_COUNT] = {
+  { "master_vol", CC_MASTER_VOL, CURVE_LINEAR, 0.0f,   1.0f,  TARGET_GLOBAL | TARGET_RECORD,
+    [](MyDsp& d, uint8_t, float v) { d.setMasterGain(v); } },
+  { "echo_on",    CC_ECHO_ON,    CURVE_SWITCH, 0.0f,   1.0f,  TARGET_GLOBAL | TARGET_RECORD,
+    [](MyDsp& d, uint8_t, float v) { d.setEchoOn(v >= 0.5f); } },
+  { "echo_mix",   CC_ECHO_MIX,   CURVE_LINEAR, 0.0f,   1.0f,  TARGET_GLOBAL | TARGET_RECORD,
+    [](MyDsp& d, uint8_t, float v) { d.setEchoMix(v); } },
+  { "echo_fb",    CC_ECHO_FB,    CURVE_LINEAR, 0.0f,   0.85f, TARGET_GLOBAL | TARGET_RECORD,
+    [](MyDsp& d, uint8_t, float v) { d.setEchoFb(v); } },
+  { "echo_ms",    CC_ECHO_MS,    CURVE_EXP,    30.0f, 800.0f, TARGET_GLOBAL | TARGET_RECORD,
+    [](MyDsp& d, uint8_t, float v) { d.setEchoMs(v); } },
+  { "sustain",    CC_SUSTAIN,    CURVE_SWITCH, 0.0f,   1.0f,  TARGET_LIVE | TARGET_RECORD,
+    [](MyDsp& d, uint8_t part, float v) { d.setSustain(part, v >= 0.5f); } },
+  { "sostenuto",  CC_SOSTENUTO,  CURVE_SWITCH, 0.0f,   1.0f,  TARGET_LIVE | TARGET_RECORD,
+    [](MyDsp& d, uint8_t part, float v) { d.setSostenuto(part, v >= 0.5f); } },
+  { "timbre",     CC_TIMBRE,     CURVE_LINEAR, 0.0f,   1.0f,  TARGET_LIVE | TARGET_RECORD,
+    [](MyDsp& d, uint8_t part, float v) { d.setMorph(part, v); } },
+};
+
+uint8_t ParamMap::gCcToParam[128];
+
+static uint8_t sLearnParam = PARAM_NONE;   // armed parameter, or NONE
+
+// --- EEPROM persistence ----------------------------------------
+
+/// CCs consumed directly by MidiHandler.
+static bool isReservedCc(uint8_t cc) {
+  return cc == CC_MIDI_LEARN
+      || (cc >= CC_LOOP_GRID && cc <= CC_LOOP_REDO)
+      || cc == CC_DATA_ENTRY_MSB || cc == CC_DATA_ENTRY_LSB
+      || (cc >= CC_NRPN_LSB && cc <= CC_RPN_MSB);
+}
+
+static void saveMap() {
+  EEPROM.update(kEepromCcMapAddr + 0, 'P');
+  EEPROM.update(kEepromCcMapAddr + 1, 'M');
+  EEPROM.update(kEepromCcMapAddr + 2, kMapVersion);
+  EEPROM.update(kEepromCcMapAddr + 3, PARAM_COUNT);
+  for (int cc = 0; cc < 128; cc++) {
+    EEPROM.update(kEepromCcMapAddr + kHeaderSize + cc, ParamMap::gCcToParam[cc]);
+  }
+}
+
+/// Returns false if there is no map in this layout (first boot,
+/// or kMapVersion changed since).  `savedCount` is PARAM_COUNT of
+/// the firmware that saved it.
+static bool loadMap(uint8_t& savedCount) {
+  if (EEPROM.read(kEepromCcMapAddr + 0) != 'P' ||
+      EEPROM.read(kEepromCcMapAddr + 1) != 'M' ||
+      EEPROM.read(kEepromCcMapAddr + 2) != kMapVersion) {
+    return false;
+  }
+  savedCount = EEPROM.read(kEepromCcMapAddr + 3);
+  for (int cc = 0; cc < 128; cc++) {
+    uint8_t id = EEPROM.read(kEepromCcMapAddr + kHeaderSize + cc);
+    bool ok = id < PARAM_COUNT && !isReservedCc(cc);
+    ParamMap::gCcToParam[cc] = ok ? id : PARAM_NONE;
+  }
+  return true;
+}
+
+/// Bind parameters the stored map predates to their default CC,
+/// where that CC is still free.  Returns how many were bound.
+static int bindNewParams(uint8_t savedCount) {
+  int bound = 0;
+  for (int id = savedCount; id < PARAM_COUNT; id++) {
+    uint8_t cc = kParams[id].defaultCc;
+    if (ParamMap::gCcToParam[cc] != PARAM_NONE || isReservedCc(cc)) continue;
+    ParamMap::gCcToParam[cc] = id;
+    bound++;
+  }
+  return bound;
+}
+
+static void fillDefaults() {
+  for (int cc = 0; cc < 128; cc++) ParamMap::gCcToParam[cc] = PARAM_NONE;
+  for (int id = 0; id < PARAM_COUNT; id++) {
+    ParamMap::gCcToParam[kParams[id].defaultCc] = id;
+  }
+}
+
+// --- Public API ------------------------------------------------
+
+void ParamMap::begin() {
+  uint8_t savedCount = PARAM_COUNT;
+  if (loadMap(savedCount)) {
+    Serial.println("[PARAM] CC map loaded from EEPROM");
+    if (savedCount != PARAM_COUNT) {
+      int bound = bindNewParams(savedCount);
+      saveMap();
+      Serial.print("[PARAM] ");
+      Serial.print(bound);
+      Serial.println(" new parameter(s) bound to their default CC");
+    }
+  } else {
+    fillDefaults();
+    saveMap();
+    Serial.println("[PARAM] CC map reset to defaults");
+  }
+}
+
+const ParamDesc& ParamMap::desc(uint8_t id) {
+  return kParams[id];
+}
+
+uint8_t ParamMap::paramForDefaultCc(uint8_t cc) {
+  for (int id = 0; id < PARAM_COUNT; id++) {
+    if (kParams[id].defaultCc == cc) return id;
+  }
+  return PARAM_NONE;
+}
+
+float ParamMap::scale(const ParamDesc& d, float x01) {
+  x01 = clampf(x01, 0.0f, 1.0f);
+  switch (d.curve) {
+    case CURVE_SWITCH: return (x01 >= 0.5f) ? d.hi : d.lo;
+    case CURVE_EXP:    return d.lo * powf(d.hi / d.lo, x01);
+    case CURVE_LINEAR:
+    default:           return d.lo + x01 * (d.hi - d.lo);
+  }
+}
+
+void ParamMap::armLearn(uint8_t id) {
+  if (id == 127) {
+    sLearnParam = PARAM_NONE;
+    resetDefaults();
+    return;
+  }
+  if (id >= PARAM_COUNT) {
+    sLearnParam = PARAM_NONE;
+    Log.println("[PARAM] Learn cancelled");
+    return;
+  }
+  sLearnParam = id;
+  Log.print("[PARAM] Learn armed for ");
+  Log.println(kParams[id].name);
+}
+
+bool ParamMap::learning() {
+  return sLearnParam != PARAM_NONE;
+}
+
+bool ParamMap::learn(uint8_t cc) {
+  if (sLearnParam == PARAM_NONE || cc >= 128 || isReservedCc(cc)) return false;
+
+  // A parameter is bound to exactly one CC: drop its old binding.
+  for (int i = 0; i < 128; i++) {
+    if (gCcToParam[i] == sLearnParam) gCcToParam[i] = PARAM_NONE;
+  }
+  gCcToParam[cc] = sLearnParam;
+  saveMap();
+
+  Log.print("[PARAM] Learned CC ");
+  Log.print(cc);
+  Log.print(" -> ");
+  Log.println(kParams[sLearnParam].name);
+
+  sLearnParam = PARAM_NONE;
+  return true;
+}
+
+void ParamMap::resetDefaults() {
+  fillDefaults();
+  saveMap();
+  Log.println("[PARAM] CC map reset to defaults");
+}
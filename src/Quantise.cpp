@@ -0,0 +1,141 @@
+// ============================================================
+// Quantise.cpp -- Tempo detection and grid snapping
+//
+// Everything here runs once per take on the main thread, when a
+// take is committed; the histogram is file-static so it stays
+// off the stack.  apply() is LoopTransform's full-strength grid.
+// ============================================================
+
+#include "Quantise.h"
+#include "LoopTransform.h"
+#include "config.h"
+#include <Audio.h>
+#include <math.h>
+#include <string.h>
+
+static constexpr uint32_t kSamplesPerMin = (uint32_t)(AUDIO_SAMPLE_RATE_EXACT * 60.0f);
+static constexpr uint32_t kMinBeat       = kSamplesPerMin / kTempoMaxBpm;
+static constexpr uint32_t kMaxBeat       = kSamplesPerMin / kTempoMinBpm;
+
+// Onset-interval histogram: ~10 ms bins up to two slowest beats
+static constexpr uint32_t kBinSamples = 441;
+static constexpr uint32_t kBins       = 2 * kMaxBeat / kBinSamples + 2;
+static constexpr uint32_t kChord      = 1323;   // onsets closer than ~30 ms count as one
+static constexpr int      kNeighbours = 8;      // intervals taken from each onset
+static constexpr int      kMinOnsets  = 4;
+static constexpr uint32_t kMinPeak    = 3;      // intervals needed around the beat
+static constexpr uint32_t kMultiples  = 4;      // beat multiples scored (more favours fast tempos)
+
+// --- Tempo inference -------------------------------------------
+
+static uint16_t sHist[kBins];
+static uint32_t sFrac[kBins];   // sum of (interval - bin start), for sub-bin precision
+
+/// Intervals in bin `b` and its two neighbours.
+static uint32_t around(uint32_t b) {
+  uint32_t n = 0;
+  for (uint32_t i = b ? b - 1 : 0; i <= b + 1 && i < kBins; i++) n += sHist[i];
+  return n;
+}
+
+/// Least-squares fit of the note-ons to a half-beat grid through
+/// the loop top (onsets far from the grid are ignored).
+static uint32_t fitBeat(const LoopTrack& take, uint32_t beat) {
+  double step = beat / 2.0;
+  double skt  = 0.0, skk = 0.0;
+
+  LoopCursor c;
+  for (take.rewind(c); c.valid; take.advance(c)) {
+    if (c.next.type != EVT_NOTE_ON) continue;
+    double t = c.next.time;
+    double k = floor(t / step + 0.5);
+    if (k < 1.0 || fabs(t - k * step) > step / 4) continue;
+    skt += k * t;
+    skk += k * k;
+  }
+  return skk > 0.0 ? (uint32_t)(2.0 * skt / skk + 0.5) : beat;
+}
+
+uint32_t Quantise::inferBeat(const LoopTrack& take) {
+  memset(sHist, 0, sizeof(sHist));
+  memset(sFrac, 0, sizeof(sFrac));
+
+  // Intervals from each onset to its kNeighbours predecessors
+  uint32_t ring[kNeighbours];
+  int      seen = 0;
+  LoopCursor c;
+  for (take.rewind(c); c.valid; take.advance(c)) {
+    if (c.next.type != EVT_NOTE_ON) continue;
+    uint32_t t = c.next.time;
+    if (seen > 0 && t - ring[(seen - 1) % kNeighbours] < kChord) continue;
+
+    for (int k = 1; k <= kNeighbours && k <= seen; k++) {
+      uint32_t d = t - ring[(seen - k) % kNeighbours];
+      uint32_t b = d / kBinSamples;
+      if (b >= kBins) break;            // older onsets are further still
+      if (sHist[b] == UINT16_MAX) continue;
+      sHist[b]++;
+      sFrac[b] += d - b * kBinSamples;
+    }
+    ring[seen % kNeighbours] = t;
+    seen++;
+  }
+  if (seen < kMinOnsets) return 0;
+
+  // The beat shows up as intervals at its multiples too, and
+  // off-beats at its half; combing them keeps 3:2 look-alikes out
+  uint32_t best = 0, bestScore = 0;
+  for (uint32_t b = kMinBeat / kBinSamples; b <= kMaxBeat / kBinSamples; b++) {
+    uint32_t score = 2 * around(b) + around(b / 2);
+    for (uint32_t m = 2; m <= kMultiples && m * b < kBins; m++) score += around(m * b);
+    if (score > bestScore) {
+      bestScore = score;
+      best      = b;
+    }
+  }
+  if (around(best) < kMinPeak) return 0;
+
+  // Mean interval around the peak, then fit to the whole take
+  uint64_t sum = 0;
+  uint32_t n   = 0;
+  for (uint32_t i = best - 1; i <= best + 1 && i < kBins; i++) {
+    sum += (uint64_t)i * kBinSamples * sHist[i] + sFrac[i];
+    n   += sHist[i];
+  }
+  return fitBeat(take, (uint32_t)(sum / n));
+}
+
+uint32_t Quantise::snapLength(uint32_t length, uint32_t beat) {
+  uint32_t beats = (length + beat / 2) / beat;
+  return (beats ? beats : 1) * beat;
+}
+
+// --- Grid ------------------------------------------------------
+
+int Quantise::chooseDivision(const LoopTrack& take, uint32_t beat) {
+  static const int kDivisions[] = { 1, 2, 3, 4, 6, 8 };   // coarsest first
+
+  for (int div : kDivisions) {
+    double step = (double)beat / div;
+    double err  = 0.0;
+    int    n    = 0;
+    LoopCursor c;
+    for (take.rewind(c); c.valid; take.advance(c)) {
+      if (c.next.type != EVT_NOTE_ON) continue;
+      double x = c.next.time / step;
+      err += fabs(x - floor(x + 0.5));
+      n++;
+    }
+    if (n == 0) return 0;
+    if (err / n <= kGridFit) return div;
+  }
+  return 0;
+}
+
+bool Quantise::apply(const LoopTrack& in, LoopTrack& out, uint32_t beat, int div, uint32_t length) {
+  LoopTransform::Params p;
+  p.length = length;
+  p.beat   = beat;
+  p.div    = div;
+  return LoopTransform::apply(in, out, p);
+}
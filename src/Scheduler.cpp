@@ -0,0 +1,103 @@
+// ============================================================
+// Scheduler.cpp -- Task passes, timing and reports
+//
+// Times are micros() differences, so they survive the 71-minute
+// wrap.  A task's first slice has no wait to check.
+// ============================================================
+
+#include "Scheduler.h"
+#include "Log.h"
+
+using Scheduler::Task;
+
+static Task*    sTasks      = nullptr;
+static int      sCount      = 0;
+static uint32_t sLastReport = 0;
+
+/// Run one slice of `t`, started at `start`.  True if it has more.
+static bool runSlice(Task& t, uint32_t start) {
+  if (t.slices > 0) {
+    uint32_t wait = start - t.lastUs;
+    if (wait > t.maxWaitUs)  t.maxWaitUs = wait;
+    if (wait > t.deadlineUs) t.missed++;
+  }
+  t.lastUs = start;
+
+  bool more = t.run();
+
+  uint32_t took = micros() - start;
+  t.slices++;
+  if (took > t.maxUs)    t.maxUs = took;
+  if (took > t.budgetUs) t.overBudget++;
+  return more;
+}
+
+void Scheduler::begin(Task* tasks, int count) {
+  sTasks = tasks;
+  sCount = count;
+  sLastReport = millis();
+
+  Serial.print("[SCHED] ");
+  Serial.print(count);
+  Serial.println(" task(s)");
+}
+
+void Scheduler::run() {
+  uint32_t passStart = micros();
+  for (int i = 0; i < sCount; i++) sTasks[i].due = true;
+
+  for (;;) {
+    int i = 0;
+    while (i < sCount && !sTasks[i].due) i++;
+    if (i == sCount) break;
+
+    Task& t = sTasks[i];
+    t.due = false;
+
+    uint32_t start = micros();
+    bool     late  = start - passStart > kSchedPassUs;
+    if (late && t.deferrable && t.slices > 0 && start - t.lastUs < t.deadlineUs) continue;
+
+    bool more = runSlice(t, start);
+    t.due = more && micros() - passStart < kSchedPassUs;
+  }
+
+  if (millis() - sLastReport >= kSchedReportMs) {
+    sLastReport = millis();
+    report(Log);
+  }
+}
+
+void Scheduler::report(Print& out) {
+  for (int i = 0; i < sCount; i++) {
+    Task& t = sTasks[i];
+    if (t.overBudget == t.shownOver && t.missed == t.shownMissed) continue;
+
+    out.print("[SCHED] ");
+    out.print(t.name);
+    out.print(": ");
+    out.print(t.overBudget - t.shownOver);
+    out.print(" slice(s) over ");
+    out.print(t.budgetUs);
+    out.print(" us (max ");
+    out.print(t.maxUs);
+    out.print("), ");
+    out.print(t.missed - t.shownMissed);
+    out.print(" wait(s) past ");
+    out.print(t.deadlineUs);
+    out.print(" us (max ");
+    out.print(t.maxWaitUs);
+    out.println(")");
+
+    t.shownOver   = t.overBudget;
+    t.shownMissed = t.missed;
+  }
+}
+
+const Task& Scheduler::task(int i) {
+  return sTasks[i];
+}
+
+int Scheduler::taskCount() {
+  return sCount;
+}
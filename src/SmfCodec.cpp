@@ -0,0 +1,250 @@
+// ============================================================
+// SmfCodec.cpp -- SMF type 0 encoding and decoding
+//
+// Writer file layout:
+//   MThd  len=6  format=0  ntrks=1  division
+//   MTrk  len (patched at the end)
+//     0  FF 51 03 tempo
+//     <delta> <status> <data...>       (no running status)
+//     ...
+//     <delta to endTime>  FF 2F 00
+// ============================================================
+
+#include "SmfCodec.h"
+#include <math.h>
+
+// --- Writer ----------------------------------------------------
+
+void SmfWriter::begin(const SmfTiming& timing, uint32_t endTime, NextFn next, void* ctx) {
+  timing_   = timing;
+  endTime_  = endTime;
+  next_     = next;
+  ctx_      = ctx;
+  phase_    = PHASE_HEADER;
+  lastTick_ = 0;
+  trackLen_ = 0;
+  pendLen_  = 0;
+  pendPos_  = 0;
+}
+
+uint32_t SmfWriter::toTicks(uint32_t time) const {
+  double ticks = (double)time * 1e6 * timing_.division
+               / (timing_.sampleRate * timing_.usPerQuarter);
+  return (uint32_t)llround(ticks);
+}
+
+/// Append the VLQ delta from the previous event to `time`.
+void SmfWriter::putDelta(uint32_t time) {
+  uint32_t tick  = toTicks(time);
+  uint32_t delta = (tick > lastTick_) ? tick - lastTick_ : 0;
+  lastTick_ += delta;
+
+  uint8_t vlq[5];
+  int     n = 0;
+  do {
+    vlq[n++] = delta & 0x7F;
+    delta >>= 7;
+  } while (delta);
+  while (n > 1) pend_[pendLen_++] = vlq[--n] | 0x80;
+  pend_[pendLen_++] = vlq[0];
+}
+
+/// Refill pend_ with the next item of the file.
+void SmfWriter::produce() {
+  pendLen_ = 0;
+  pendPos_ = 0;
+
+  switch (phase_) {
+    case PHASE_HEADER: {
+      static const uint8_t kHead[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,  0, 0,  0, 1,  0, 0,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0,
+      };
+      for (uint8_t b : kHead) pend_[pendLen_++] = b;
+      pend_[12] = timing_.division >> 8;
+      pend_[13] = timing_.division & 0xFF;
+
+      // Tempo meta event at tick 0
+      uint32_t t = timing_.usPerQuarter;
+      const uint8_t tempo[] = { 0, 0xFF, 0x51, 0x03,
+                                (uint8_t)(t >> 16), (uint8_t)(t >> 8), (uint8_t)t };
+      for (uint8_t b : tempo) pend_[pendLen_++] = b;
+      trackLen_ += sizeof(tempo);
+      phase_ = PHASE_EVENTS;
+      return;
+    }
+
+    case PHASE_EVENTS: {
+      SmfEvent ev;
+      if (!next_ || !next_(ctx_, ev)) {
+        phase_ = PHASE_END;
+        produce();
+        return;
+      }
+      putDelta(ev.time);
+      pend_[pendLen_++] = ev.status;
+      pend_[pendLen_++] = ev.data1 & 0x7F;
+      uint8_t kind = ev.status & 0xF0;
+      if (kind != 0xC0 && kind != 0xD0) pend_[pendLen_++] = ev.data2 & 0x7F;
+      trackLen_ += pendLen_;
+      return;
+    }
+
+    case PHASE_END:
+      putDelta(endTime_);
+      pend_[pendLen_++] = 0xFF;
+      pend_[pendLen_++] = 0x2F;
+      pend_[pendLen_++] = 0x00;
+      trackLen_ += pendLen_;
+      phase_ = PHASE_DONE;
+      return;
+
+    case PHASE_DONE:
+      return;
+  }
+}
+
+size_t SmfWriter::read(uint8_t* out, size_t cap) {
+  size_t n = 0;
+  while (n < cap) {
+    if (pendPos_ == pendLen_) {
+      if (phase_ == PHASE_DONE) break;
+      produce();
+      if (pendLen_ == 0) break;
+    }
+    while (n < cap && pendPos_ < pendLen_) out[n++] = pend_[pendPos_++];
+  }
+  return n;
+}
+
+void SmfWriter::trackLengthBytes(uint8_t out[4]) const {
+  out[0] = trackLen_ >> 24;
+  out[1] = trackLen_ >> 16;
+  out[2] = trackLen_ >> 8;
+  out[3] = trackLen_;
+}
+
+// --- Reader ----------------------------------------------------
+
+int SmfReader::byte() {
+  int b = read_(ctx_);
+  if (b < 0) error_ = true;
+  return b < 0 ? 0 : b;
+}
+
+uint32_t SmfReader::readBe(int n) {
+  uint32_t v = 0;
+  while (n--) v = (v << 8) | (uint32_t)byte();
+  return v;
+}
+
+uint32_t SmfReader::readVlq() {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    uint8_t b = byte();
+    if (left_) left_--;
+    v = (v << 7) | (b & 0x7F);
+    if (!(b & 0x80)) break;
+  }
+  return v;
+}
+
+void SmfReader::skip(uint32_t n) {
+  while (n-- && !error_) byte();
+}
+
+uint32_t SmfReader::toSamples() const {
+  double us = (double)usTicks_ / division_;
+  return (uint32_t)llround(us * sampleRate_ / 1e6);
+}
+
+bool SmfReader::begin(ReadFn read, void* ctx, double sampleRate) {
+  read_       = read;
+  ctx_        = ctx;
+  sampleRate_ = sampleRate;
+  tempo_      = 500000;
+  usTicks_    = 0;
+  status_     = 0;
+  error_      = false;
+  ended_      = true;
+
+  if (readBe(4) != 0x4D546864 /* MThd */) return false;
+  uint32_t len    = readBe(4);
+  uint16_t format = readBe(2);
+  uint16_t ntrks  = readBe(2);
+  division_       = readBe(2);
+  if (len > 6) skip(len - 6);
+
+  if (error_ || division_ == 0 || (division_ & 0x8000)) return false;   // no SMPTE time
+  if (!(format == 0 || (format == 1 && ntrks == 1))) return false;
+
+  // Skip any non-track chunks
+  for (;;) {
+    uint32_t id = readBe(4);
+    len = readBe(4);
+    if (error_) return false;
+    if (id == 0x4D54726B /* MTrk */) break;
+    skip(len);
+  }
+  left_  = len;
+  ended_ = false;
+  return true;
+}
+
+bool SmfReader::next(SmfEvent& ev) {
+  while (!ended_ && !error_ && left_ > 0) {
+    usTicks_ += (uint64_t)readVlq() * tempo_;
+
+    uint8_t b = byte();
+    left_--;
+
+    if (b == 0xFF) {                       // meta event
+      uint8_t  type = byte();
+      left_--;
+      uint32_t len  = readVlq();
+      if (type == 0x2F) {
+        ended_ = true;
+        return false;
+      }
+      if (type == 0x51 && len == 3) tempo_ = readBe(3);
+      else                          skip(len);
+      left_ -= (len < left_) ? len : left_;
+      continue;
+    }
+    if (b == 0xF0 || b == 0xF7) {          // SysEx: skip
+      uint32_t len = readVlq();
+      skip(len);
+      left_ -= (len < left_) ? len : left_;
+      status_ = 0;
+      continue;
+    }
+
+    uint8_t d1;
+    if (b & 0x80) {
+      status_ = b;
+      d1 = byte();
+      left_--;
+    } else {
+      if (!status_) {                     // data byte with no status
+        error_ = true;
+        break;
+      }
+      d1 = b;                              // running status
+    }
+
+    uint8_t kind = status_ & 0xF0;
+    uint8_t d2   = 0;
+    if (kind != 0xC0 && kind != 0xD0) {
+      d2 = byte();
+      left_--;
+    }
+
+    ev.time   = toSamples();
+    ev.status = status_;
+    ev.data1  = d1 & 0x7F;
+    ev.data2  = d2 & 0x7F;
+    return !error_;
+  }
+  ended_ = true;
+  return false;
+}
@@ -2,15 +2,28 @@
 // main.cpp -- Entry point for the Synteensyzer
 //
 // This file is intentionally short.  It only does three things:
-//   1. Declares the Teensy Audio graph (synths, mixer, output)
+//   1. Declares the Teensy Audio graph (synth engine, output)
 //   2. Initialises hardware in setup()
-//   3. Runs the main loop (button → MIDI → looper playback)
+//   3. Runs the main loop: prioritised tasks (MIDI → clock → looper →
+//      controls → log → saving) under the cooperative Scheduler
 //
 // All logic lives in dedicated modules:
 //   MyDsp         → polyphonic synth engine
 //   Looper        → record / play / stop state machine
-//   DebouncedButton → hardware button with debounce
+//   DebouncedButton → hardware button, short / long press
+//   ButtonScanner → timer-driven debounce + button event queue
+//   ButtonMatrix  → scanned key matrix for the control panel
+//   Panel         → panel gestures → synth / looper / MIDI actions
+//   Knobs         → oversampled, filtered pots → ParamMap parameters
 //   MidiHandler   → USB MIDI message routing
+//   ParamMap      → CC → parameter table + MIDI learn (EEPROM)
+//   LoopStore     → loop save / load as a MIDI file (SD card)
+//   LoopArena     → chunk memory shared by every loop stream
+//   LoopTransform → grid / humanise / transpose / velocity rewrites
+//   MidiClock     → MIDI clock in (slave) / out (master)
+//   Scheduler     → main-loop tasks, budgets and deadline counters
+//   Log           → serial log buffered in RAM, drained in slices
+//   Metrics       → audio / loop / MIDI load counters, SysEx + serial reports
 // ============================================================
 
 #include <Arduino.h>
@@ -19,67 +32,110 @@
 #include "MyDsp.h"
 #include "Looper.h"
 #include "MidiHandler.h"
+#include "LoopStore.h"
+#include "MidiClock.h"
 #include "Button.h"
+#include "Panel.h"
+#include "Knobs.h"
+#include "Scheduler.h"
+#include "Log.h"
+#include "Metrics.h"
 
 // === Audio graph ===============================================
-// Two synth instances (live + looper) are mixed to stereo
-// output through the SGTL5000 codec on the Audio Shield.
+// One multi-timbral synth engine plays every MIDI channel and the
+// looper (PART_LOOP) from a shared voice pool, straight into the
+// SGTL5000 codec on the Audio Shield.
 //
-//   liveSynth ──L/R──┐
-//                     ├── mixerL/R ──► AudioOutputI2S ──► headphones
-//   looperSynth ─L/R─┘
+//   synth ──L/R──► AudioOutputI2S ──► headphones
 
-MyDsp liveSynth;
-MyDsp looperSynth;
+MyDsp synth;
 
-AudioMixer4          mixerL;
-AudioMixer4          mixerR;
 AudioOutputI2S       audioOut;
 AudioControlSGTL5000 codec;
 
-// Patch cables: each synth feeds both L and R mixer inputs
-AudioConnection patchLiveL (liveSynth,   0, mixerL,   0);
-AudioConnection patchLiveR (liveSynth,   1, mixerR,   0);
-AudioConnection patchLoopL (looperSynth, 0, mixerL,   1);
-AudioConnection patchLoopR (looperSynth, 1, mixerR,   1);
-AudioConnection patchOutL  (mixerL,      0, audioOut,  0);
-AudioConnection patchOutR  (mixerR,      0, audioOut,  1);
+AudioConnection patchOutL (synth, 0, audioOut, 0);
+AudioConnection patchOutR (synth, 1, audioOut, 1);
 
 // === Modules ===================================================
 
-Looper looper(liveSynth, looperSynth);
+Looper looper(synth);
 
 // Button callbacks (simple wrappers forwarding to the looper)
 static void onShortPress() { looper.onShortPress(); }
 static void onLongPress()  { looper.onLongPress();  }
+static void onSceneShort() { looper.nextScene();     }
+static void onSceneLong()  { looper.selectScene(0);  }
+
+// Audio-ISR hook: loop playback at exact sample offsets
+static void onAudioBlock(uint32_t blockStart) { looper.renderBlock(blockStart); }
 
 DebouncedButton loopButton(kLoopButtonPin, onShortPress, onLongPress);
+DebouncedButton sceneButton(kSceneButtonPin, onSceneShort, onSceneLong);
+
+// === Main-loop tasks ===========================================
+// One slice each; true = more work waiting (see Scheduler.h).
+
+static bool taskMidi() {
+  for (int n = 0; n < kMidiSliceMsgs; n++) {
+    if (!usbMIDI.read()) return false;
+    MidiHandler::process();
+  }
+  return true;                           // more may be queued
+}
+
+static bool taskClock()  { MidiClock::poll(); return false; }
+static bool taskLooper() { looper.tick();     return false; }
+
+static bool taskControls() {
+  ButtonScanner::poll();
+  Panel::poll();
+  Knobs::poll();
+  return false;
+}
+
+static bool taskMetrics() { Metrics::poll(); return false; }
+static bool taskLog()     { return Log.drain(kLogSliceBytes); }
+static bool taskPersist() { LoopStore::poll(); return LoopStore::busy(); }
+
+// Highest priority first.  Budget: longest slice expected;
+// deadline: longest the task should wait between slices (us).
+// No budget may reach midi's deadline, or one slice of that task
+// would be enough to make MIDI miss it.
+static Scheduler::Task tasks[] = {
+  //  name        slice          budget  deadline  deferrable
+  { "midi",     taskMidi,        500,    2000,    false },
+  { "clock",    taskClock,       100,    1000,    false },   // master pulses go out on time
+  { "looper",   taskLooper,      500,    2900,    false },   // one audio block
+  { "controls", taskControls,    300,   20000,    true  },
+  { "metrics",  taskMetrics,     300,  100000,    true  },
+  { "log",      taskLog,         300,  100000,    true  },
+  { "persist",  taskPersist,    1000,  500000,    true  },   // <= one SD sector write
+};
 
 // === setup =====================================================
 
 void setup() {
   Serial.begin(115200);
   delay(1000);
-  Serial.println("\n=== SYNTEENSYZER (DUAL SYNTH + LOOPER) ===");
+  Serial.println("\n=== SYNTEENSYZER (MULTI-TIMBRAL SYNTH + LOOPER) ===");
 
-  // Allocate audio memory blocks (enough for two synth engines)
-  AudioMemory(60);
+  // Allocate audio memory blocks (one engine, two output blocks per update)
+  AudioMemory(30);
   codec.enable();
   codec.volume(0.5);
-
-  // Mix live and looper at equal gain
-  mixerL.gain(0, 0.5);   // live  left
-  mixerL.gain(1, 0.5);   // loop  left
-  mixerR.gain(0, 0.5);   // live  right
-  mixerR.gain(1, 0.5);   // loop  right
-  Serial.println("Audio initialised (dual synth + mixer)");
+  Serial.println("Audio initialised (single engine)");
 
   loopButton.begin();
-  MidiHandler::begin(liveSynth, looperSynth, looper);
-
-  // Both synths start on preset 0
-  liveSynth.setPreset(0);
-  looperSynth.setPreset(0);
+  sceneButton.begin();
+  ButtonScanner::begin();
+  MidiHandler::begin(synth, looper);
+  Panel::begin(synth, looper);
+  Knobs::begin();
+  LoopStore::begin(looper);
+  MidiClock::begin();
+  Metrics::begin();
+  if (kLooperAudioThread) synth.setBlockCallback(onAudioBlock);
+  Scheduler::begin(tasks, sizeof(tasks) / sizeof(tasks[0]));
 
   Serial.println("Ready!\n");
 }
@@ -87,11 +143,7 @@ void setup() {
 // === loop ======================================================
 
 void loop() {
-  loopButton.update();                   // 1. Read the physical button
-
-  while (usbMIDI.read()) {              // 2. Process all pending MIDI messages
-    MidiHandler::process();
-  }
-
-  looper.tick();                         // 3. Advance looper playback
+  uint32_t start = ARM_DWT_CYCCNT;
+  Scheduler::run();
+  Metrics::loopPass(ARM_DWT_CYCCNT - start);
 }
@@ -0,0 +1,194 @@
+// ============================================================
+// test_smf.cpp -- SmfCodec host tests (PlatformIO Unity)
+//
+//   pio test -e native
+//
+// SmfCodec has no Arduino dependency, so it runs on the host:
+//   - a take written by SmfWriter reads back event for event,
+//     with the same time base LoopStore uses
+//   - a hand-made type 0 file with running status and a tempo
+//     change part-way through decodes to the right sample times
+// ============================================================
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+#include <math.h>
+#include "SmfCodec.h"
+
+// --- Helpers ---------------------------------------------------
+
+struct Source {
+  const SmfEvent* events;
+  size_t          count;
+  size_t          pos;
+};
+
+static bool nextEvent(void* ctx, SmfEvent& ev) {
+  Source* s = static_cast<Source*>(ctx);
+  if (s->pos >= s->count) return false;
+  ev = s->events[s->pos++];
+  return true;
+}
+
+struct Bytes {
+  const uint8_t* data;
+  size_t         len;
+  size_t         pos;
+};
+
+static int readByte(void* ctx) {
+  Bytes* b = static_cast<Bytes*>(ctx);
+  return b->pos < b->len ? b->data[b->pos++] : -1;
+}
+
+/// Whole file from `w`, pulled `chunk` bytes at a time (as
+/// LoopStore::poll() does), with the track length patched in.
+static std::vector<uint8_t> writeAll(SmfWriter& w, size_t chunk) {
+  std::vector<uint8_t> file;
+  uint8_t buf[64];
+  size_t  n;
+  while ((n = w.read(buf, chunk)) > 0) file.insert(file.end(), buf, buf + n);
+  w.trackLengthBytes(&file[SmfWriter::kTrackLengthOffset]);
+  return file;
+}
+
+static void assertEvent(const SmfEvent& want, const SmfEvent& got) {
+  TEST_ASSERT_EQUAL_UINT32(want.time, got.time);
+  TEST_ASSERT_EQUAL_HEX8(want.status, got.status);
+  TEST_ASSERT_EQUAL_UINT8(want.data1, got.data1);
+  TEST_ASSERT_EQUAL_UINT8(want.data2, got.data2);
+}
+
+// --- Round trip ------------------------------------------------
+
+// LoopStore's time base: one file tick = one 16-sample loop tick
+static const double kSampleRate = 44117.64706;
+
+static SmfTiming loopTiming() {
+  SmfTiming t;
+  t.sampleRate   = kSampleRate;
+  t.division     = 960;
+  t.usPerQuarter = (uint32_t)lround(1e6 * 960 * 16 / kSampleRate);
+  return t;
+}
+
+static void test_round_trip() {
+  std::vector<SmfEvent> take;
+  take.push_back({ 0, 0xC0, 2, 0 });
+  for (uint32_t i = 0; i < 300; i++) {
+    uint32_t on = i * 16 * 37;
+    uint8_t  n  = (uint8_t)(48 + i % 24);
+    take.push_back({ on,           0x90, n, (uint8_t)(40 + i % 80) });
+    take.push_back({ on + 16 * 3,  0xB0, 1, (uint8_t)(i & 0x7F) });
+    take.push_back({ on + 16 * 20, 0x80, n, 0 });
+  }
+  take.push_back({ 300 * 16 * 37, 0xE0, 0x00, 0x40 });
+  uint32_t endTime = 300 * 16 * 37 + 16 * 100;
+
+  // Writer output is in time order only if the source is
+  for (size_t i = 1; i < take.size(); i++) {
+    for (size_t j = i; j > 0 && take[j].time < take[j - 1].time; j--) {
+      SmfEvent t = take[j]; take[j] = take[j - 1]; take[j - 1] = t;
+    }
+  }
+
+  Source    src = { take.data(), take.size(), 0 };
+  SmfWriter w;
+  w.begin(loopTiming(), endTime, nextEvent, &src);
+  std::vector<uint8_t> file = writeAll(w, 7);
+  TEST_ASSERT_TRUE(w.done());
+
+  // Header: format 0, one track, our division
+  TEST_ASSERT_EQUAL_MEMORY("MThd", &file[0], 4);
+  TEST_ASSERT_EQUAL_UINT8(0, file[9]);
+  TEST_ASSERT_EQUAL_UINT8(1, file[11]);
+  TEST_ASSERT_EQUAL_UINT8(960 >> 8, file[12]);
+  TEST_ASSERT_EQUAL_UINT8(960 & 0xFF, file[13]);
+  uint32_t trackLen = ((uint32_t)file[18] << 24) | (file[19] << 16) | (file[20] << 8) | file[21];
+  TEST_ASSERT_EQUAL_UINT32(file.size() - 22, trackLen);
+
+  Bytes     in = { file.data(), file.size(), 0 };
+  SmfReader r;
+  TEST_ASSERT_TRUE(r.begin(readByte, &in, kSampleRate));
+  SmfEvent ev;
+  size_t   i = 0;
+  while (r.next(ev)) {
+    TEST_ASSERT_LESS_THAN(take.size(), i);
+    assertEvent(take[i], ev);
+    i++;
+  }
+  TEST_ASSERT_FALSE(r.error());
+  TEST_ASSERT_EQUAL(take.size(), i);
+  TEST_ASSERT_EQUAL_UINT32(endTime, r.endTime());
+}
+
+// --- Fixture: running status and a tempo change -----------------
+// 96 ticks per quarter, read at 1000 samples/s so a sample is a ms:
+// 500000 us/quarter -> 48 ticks = 250 ms; after the change to
+// 1000000 us/quarter, 96 ticks = 1000 ms.
+
+static const uint8_t kRunningStatusFile[] = {
+  'M', 'T', 'h', 'd', 0, 0, 0, 6,  0, 0,  0, 1,  0, 96,
+  'M', 'T', 'r', 'k', 0, 0, 0, 42,
+  0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,   // tempo 500000
+  0x00, 0xC1, 0x05,                           // program 5, ch 2
+  0x00, 0x91, 0x3C, 0x64,                     // note on 60
+  0x30, 0x3E, 0x50,                           // (running) note on 62
+  0x30, 0x3C, 0x00,                           // (running) note 60 vel 0
+  0x00, 0xFF, 0x51, 0x03, 0x0F, 0x42, 0x40,   // tempo 1000000
+  0x00, 0x81, 0x3E, 0x40,                     // note off 62
+  0x60, 0xB1, 0x07, 0x64,                     // CC 7
+  0x18, 0x0A, 0x20,                           // (running) CC 10
+  0x00, 0xFF, 0x2F, 0x00,                     // end of track
+};
+
+static void test_running_status_and_tempo() {
+  static const SmfEvent kWant[] = {
+    {    0, 0xC1,  5,   0 },
+    {    0, 0x91, 60, 100 },
+    {  250, 0x91, 62,  80 },
+    {  500, 0x91, 60,   0 },
+    {  500, 0x81, 62,  64 },
+    { 1500, 0xB1,  7, 100 },
+    { 1750, 0xB1, 10,  32 },
+  };
+
+  Bytes     in = { kRunningStatusFile, sizeof(kRunningStatusFile), 0 };
+  SmfReader r;
+  TEST_ASSERT_TRUE(r.begin(readByte, &in, 1000.0));
+
+  SmfEvent ev;
+  size_t   i = 0;
+  while (r.next(ev)) {
+    TEST_ASSERT_LESS_THAN(sizeof(kWant) / sizeof(kWant[0]), i);
+    assertEvent(kWant[i], ev);
+    i++;
+  }
+  TEST_ASSERT_FALSE(r.error());
+  TEST_ASSERT_EQUAL(sizeof(kWant) / sizeof(kWant[0]), i);
+  TEST_ASSERT_EQUAL_UINT32(1750, r.endTime());
+}
+
+static void test_rejects_smpte_division() {
+  uint8_t file[sizeof(kRunningStatusFile)];
+  memcpy(file, kRunningStatusFile, sizeof(file));
+  file[12] = 0xE7;                           // -25 fps
+  file[13] = 40;
+  Bytes     in = { file, sizeof(file), 0 };
+  SmfReader r;
+  TEST_ASSERT_FALSE(r.begin(readByte, &in, 1000.0));
+}
+
+// --- Runner ----------------------------------------------------
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_running_status_and_tempo);
+  RUN_TEST(test_rejects_smpte_division);
+  return UNITY_END();
+}